@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# Headless benchmarks of the move, resize and snap paths.
+# Run with: ./benchmarks (the offscreen platform is selected automatically)
+#
+#-------------------------------------------------
+
+QT       += core gui testlib network
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = benchmarks
+TEMPLATE = app
+CONFIG += c++11 testcase console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS WM_CONTROL_SERVER
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    tst_winmanager.cpp \
+    ../winmanager.cpp
+
+HEADERS += \
+    ../winmanager.h \
+    ../wmgeometry.h
@@ -0,0 +1,445 @@
+#include <QtTest>
+#include <QWidget>
+#include <QLocalSocket>
+#include "winmanager.h"
+
+// Drives synthetic mouse streams through WinManager without a display.
+// FramePacing is disabled, so every event is applied synchronously and
+// the measured time is the cost of the event filter paths themselves.
+
+class WinManagerBenchmark : public QObject
+{
+    Q_OBJECT
+public:
+    WinManagerBenchmark();
+private slots:
+    void init();
+    void cleanup();
+
+    void longDrag_data();
+    void longDrag();
+    void edgeCrossing_data();
+    void edgeCrossing();
+    void cornerResize_data();
+    void cornerResize();
+    void maximizeRestore_data();
+    void maximizeRestore();
+    void snapUnsnap_data();
+    void snapUnsnap();
+
+    void systemMove();
+
+    void geometryEngine();
+
+    void snapZones();
+
+    void recordReplay();
+
+    void postedCommands();
+
+    void controlServer();
+private:
+    struct Managed
+    {
+        QWidget *window;
+        WinManager *manager;
+    };
+    QList<Managed> windows;
+    QRect desktop;
+
+    void createWindows(int count);
+    void addWindowCounts();
+    static void send(QWidget *target, QEvent::Type type, const QPoint &global, Qt::MouseButtons buttons);
+    static void press(QWidget *target, const QPoint &global);
+    static void move(QWidget *target, const QPoint &global);
+    static void release(QWidget *target, const QPoint &global);
+    static void drag(QWidget *target, const QPoint &from, const QPoint &to, int steps);
+};
+
+WinManagerBenchmark::WinManagerBenchmark()
+{
+    QCoreApplication::setApplicationName("WinManagerBenchmark");
+}
+
+void WinManagerBenchmark::init()
+{
+    desktop = QGuiApplication::primaryScreen()->availableGeometry();
+}
+
+void WinManagerBenchmark::cleanup()
+{
+    for(const Managed &m : windows)
+        delete m.window;
+    windows.clear();
+}
+
+void WinManagerBenchmark::createWindows(int count)
+{
+    for(int i = 0; i < count; ++i) {
+        Managed m;
+        m.window = new QWidget;
+        m.window->setObjectName(QString("window%1").arg(i));
+        m.window->setMinimumSize(100,100);
+        m.manager = new WinManager(m.window);
+        m.manager->disableFlags(WM::SaveGeometry|WM::FramePacing);
+        m.manager->setBorderWidth(8);
+        m.window->setGeometry(desktop.x()+desktop.width()/4,desktop.y()+desktop.height()/4,
+                              desktop.width()/2,desktop.height()/2);
+        m.window->show();
+        windows.append(m);
+    }
+    QCoreApplication::processEvents();
+}
+
+void WinManagerBenchmark::addWindowCounts()
+{
+    QTest::addColumn<int>("count");
+    QTest::newRow("1 window") << 1;
+    QTest::newRow("10 windows") << 10;
+    QTest::newRow("100 windows") << 100;
+}
+
+void WinManagerBenchmark::send(QWidget *target, QEvent::Type type, const QPoint &global, Qt::MouseButtons buttons)
+{
+    const QPoint local = target->mapFromGlobal(global);
+    const Qt::MouseButton button = type == QEvent::MouseMove ? Qt::NoButton : Qt::LeftButton;
+    QMouseEvent event(type,local,target->window()->mapFromGlobal(global),global,button,buttons,Qt::NoModifier);
+    QApplication::sendEvent(target,&event);
+}
+
+void WinManagerBenchmark::press(QWidget *target, const QPoint &global)
+{ send(target,QEvent::MouseButtonPress,global,Qt::LeftButton); }
+
+void WinManagerBenchmark::move(QWidget *target, const QPoint &global)
+{ send(target,QEvent::MouseMove,global,Qt::LeftButton); }
+
+void WinManagerBenchmark::release(QWidget *target, const QPoint &global)
+{ send(target,QEvent::MouseButtonRelease,global,Qt::NoButton); }
+
+void WinManagerBenchmark::drag(QWidget *target, const QPoint &from, const QPoint &to, int steps)
+{
+    for(int i = 1; i <= steps; ++i)
+        move(target,from+(to-from)*i/steps);
+}
+
+void WinManagerBenchmark::longDrag_data()
+{ addWindowCounts(); }
+
+void WinManagerBenchmark::longDrag()
+{
+    QFETCH(int,count);
+    createWindows(count);
+    const QPoint center = desktop.center();
+    QBENCHMARK {
+        for(const Managed &m : windows) {
+            QPoint start = m.window->geometry().center();
+            press(m.window,start);
+            drag(m.window,start,center+QPoint(100,50),100);
+            drag(m.window,center+QPoint(100,50),center-QPoint(100,50),100);
+            drag(m.window,center-QPoint(100,50),start,100);
+            release(m.window,start);
+        }
+    }
+    QCOMPARE(windows.first().manager->metrics().rectShows,quint64(0));
+}
+
+void WinManagerBenchmark::edgeCrossing_data()
+{ addWindowCounts(); }
+
+void WinManagerBenchmark::edgeCrossing()
+{
+    QFETCH(int,count);
+    createWindows(count);
+    const QPoint left(desktop.left(),desktop.center().y());
+    const QPoint right(desktop.right(),desktop.center().y());
+    QBENCHMARK {
+        for(const Managed &m : windows) {
+            QPoint start = m.window->geometry().center();
+            press(m.window,start);
+            for(int i = 0; i < 5; ++i) {
+                drag(m.window,start,left,20);
+                drag(m.window,left,right,40);
+                drag(m.window,right,start,20);
+            }
+            release(m.window,start);
+        }
+    }
+    QVERIFY(windows.first().manager->metrics().rectShows > 0);
+}
+
+void WinManagerBenchmark::cornerResize_data()
+{ addWindowCounts(); }
+
+void WinManagerBenchmark::cornerResize()
+{
+    QFETCH(int,count);
+    createWindows(count);
+    QBENCHMARK {
+        for(const Managed &m : windows) {
+            // The #frame is the topmost child under the masked border
+            QPoint corner = m.window->geometry().bottomRight()-QPoint(2,2);
+            QWidget *frame = m.window->childAt(m.window->mapFromGlobal(corner));
+            QWidget *target = frame ? frame : m.window;
+            press(target,corner);
+            drag(target,corner,corner+QPoint(120,80),50);
+            drag(target,corner+QPoint(120,80),corner,50);
+            release(target,corner);
+        }
+    }
+    QVERIFY(windows.first().manager->metrics().geometryApplications > 0);
+}
+
+void WinManagerBenchmark::maximizeRestore_data()
+{ addWindowCounts(); }
+
+void WinManagerBenchmark::maximizeRestore()
+{
+    QFETCH(int,count);
+    createWindows(count);
+    for(const Managed &m : windows)
+        m.manager->overrideMaximizeSides(WM::top);
+    const QPoint top(desktop.center().x(),desktop.top());
+    const QPoint center = desktop.center();
+    QBENCHMARK {
+        for(const Managed &m : windows) {
+            QPoint start = m.window->geometry().center();
+            press(m.window,start);
+            drag(m.window,start,top,30);
+            release(m.window,top);
+            press(m.window,top+QPoint(0,20));
+            drag(m.window,top+QPoint(0,20),center,30);
+            release(m.window,center);
+        }
+    }
+    QVERIFY(!windows.first().window->isMaximized());
+}
+
+void WinManagerBenchmark::snapUnsnap_data()
+{ addWindowCounts(); }
+
+void WinManagerBenchmark::snapUnsnap()
+{
+    QFETCH(int,count);
+    createWindows(count);
+    const QPoint left(desktop.left(),desktop.center().y());
+    const QPoint right(desktop.right(),desktop.center().y());
+    const QPoint center = desktop.center();
+    QBENCHMARK {
+        for(const Managed &m : windows) {
+            QPoint start = m.window->geometry().center();
+            press(m.window,start);
+            drag(m.window,start,left,30);
+            release(m.window,left);
+            press(m.window,left+QPoint(40,0));
+            drag(m.window,left+QPoint(40,0),right,30);
+            release(m.window,right);
+            press(m.window,right-QPoint(40,0));
+            drag(m.window,right-QPoint(40,0),center,30);
+            release(m.window,center);
+        }
+    }
+    QVERIFY(windows.first().manager->metrics().applyLatency[WM::SnapMetric].total() > 0);
+}
+
+void WinManagerBenchmark::systemMove()
+{
+    // Offscreen has no window system to pass the move to, so the window is moved as usual.
+    // Under xcb with a window manager the move is passed on and the window only follows the pointer
+    createWindows(1);
+    const Managed &m = windows.first();
+    m.manager->setFlags(WM::SystemMoveResize);
+    const QPoint start = m.window->geometry().center();
+    const QPoint origin = m.window->pos();
+    press(m.window,start);
+    drag(m.window,start,start+QPoint(40,30),10);
+    release(m.window,start+QPoint(40,30));
+    if(QGuiApplication::platformName() == "offscreen")
+        QCOMPARE(m.window->pos(),origin+QPoint(40,30));
+    QVERIFY(!m.window->isMaximized());
+}
+
+// The one-expression functions of the engine are usable in constant expressions
+Q_STATIC_ASSERT(WM::Geometry::desktopSide(QPoint(0,0),QRect(0,0,100,100)) == WM::top_left);
+Q_STATIC_ASSERT(WM::Geometry::windowSide(QSize(100,100),8,QPoint(50,95)) == WM::bottom);
+Q_STATIC_ASSERT(WM::Geometry::resized(QRect(0,0,100,100),WM::bottom_right,QPoint(150,120)) == QRect(0,0,150,120));
+
+void WinManagerBenchmark::geometryEngine()
+{
+    // A resize by the top left corner and the desktop side under the cursor, without widgets,
+    // for a million cursor positions
+    const QRect available = desktop;
+    const WM::Geometry::Limits limits = {QSize(100,100),QSize(QWIDGETSIZE_MAX,QWIDGETSIZE_MAX)};
+    const QRect start(available.center(),QSize(400,300));
+    const QPoint offset = WM::Geometry::captureOffset(start,WM::top_left,start.topLeft()+QPoint(2,2));
+    int sides = 0;
+    QRect rect;
+    QBENCHMARK {
+        rect = start;
+        for(int i = 0; i < 1000000; ++i) {
+            const QPoint cursor(available.x()+i%available.width(),available.y()+(i/7)%available.height());
+            rect = WM::Geometry::constrained(WM::Geometry::resized(rect,WM::top_left,cursor-offset),WM::top_left,limits);
+            sides += WM::Geometry::desktopSide(cursor,available);
+        }
+    }
+    QVERIFY(rect.width() >= 100 && rect.height() >= 100);
+    QVERIFY(sides > 0);
+}
+
+void WinManagerBenchmark::snapZones()
+{
+    // Halves chosen on the left and right edges, read from a file
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    auto write = [&dir](const QString &name, const QByteArray &json) {
+        QFile file(dir.filePath(name));
+        file.open(QIODevice::WriteOnly);
+        file.write(json);
+        return file.fileName();
+    };
+    const WM::SnapLayout layout = WM::loadSnapLayout(write("halves.json",
+        R"({"zones":[{"target":[0,0,0.5,1],"triggers":[[0,0,0,1]]},{"target":[0.5,0,0.5,1],"triggers":[[1,0,0,1]]}]})"));
+    QCOMPARE(layout.size(),2);
+    QCOMPARE(layout[1].triggers.size(),1);
+
+    createWindows(1);
+    const Managed &m = windows.first();
+    m.manager->setSnapLayout(layout);
+    const int half = qRound(desktop.width()*0.5);
+    const QPoint left(desktop.left(),desktop.center().y());
+    const QPoint right(desktop.right(),desktop.center().y());
+    QPoint start = m.window->geometry().center();
+    press(m.window,start);
+    drag(m.window,start,left,30);
+    release(m.window,left);
+    QCOMPARE(m.window->geometry(),QRect(desktop.x(),desktop.y(),half,desktop.height()));
+    press(m.window,left+QPoint(40,0));
+    drag(m.window,left+QPoint(40,0),right,30);
+    release(m.window,right);
+    QCOMPARE(m.window->geometry(),QRect(desktop.x()+half,desktop.y(),desktop.width()-half,desktop.height()));
+
+    // A typo in a trigger or target rejects the whole layout instead of adding a trigger in the corner
+    QVERIFY(WM::loadSnapLayout(write("trigger.json",
+        R"({"zones":[{"target":[0,0,0.5,1],"triggers":[[0,0,1]]}]})")).isEmpty());
+    QVERIFY(WM::loadSnapLayout(write("value.json",
+        R"({"zones":[{"target":[0,0,0.5,1],"triggers":[[0,0,"0",1]]}]})")).isEmpty());
+    QVERIFY(WM::loadSnapLayout(write("target.json",
+        R"({"zones":[{"target":[0,0,0.5],"triggers":[[0,0,0,1]]}]})")).isEmpty());
+    QVERIFY(WM::loadSnapLayout(dir.filePath("missing.json")).isEmpty());
+}
+
+void WinManagerBenchmark::recordReplay()
+{
+    // A drag that snaps to the left side, replayed on a fresh window, ends the same way
+    createWindows(1);
+    const Managed &recorded = windows.first();
+    const QPoint left(desktop.left(),desktop.center().y());
+    const QPoint start = recorded.window->geometry().center();
+    recorded.manager->startRecording();
+    press(recorded.window,start);
+    drag(recorded.window,start,left,30);
+    release(recorded.window,left);
+    const QByteArray trace = recorded.manager->stopRecording();
+    QVERIFY(!trace.isEmpty());
+
+    createWindows(1);
+    const Managed &fresh = windows.last();
+    const WM::ReplayResult result = fresh.manager->replay(trace);
+    QVERIFY(result.valid);
+    QVERIFY(result.sameScreens);
+    QCOMPARE(result.eventTimes.size(),32);
+    QCOMPARE(result.geometry,recorded.window->geometry());
+    QCOMPARE(fresh.window->geometry(),recorded.window->geometry());
+    QCOMPARE(result.snapSide,WM::Side::left);
+
+    // The header is "WMTR" and a 16-bit version, each event takes 16 bytes
+    QByteArray version = trace;
+    version[5] = char(version[5]+1);
+    QVERIFY(!fresh.manager->replay(version).valid);
+    QByteArray magic = trace;
+    magic[0] = 'X';
+    QVERIFY(!fresh.manager->replay(magic).valid);
+    QVERIFY(!fresh.manager->replay(trace.left(trace.size()-3)).valid);
+    QVERIFY(!fresh.manager->replay(trace.left(8)).valid);
+    QVERIFY(!fresh.manager->replay(QByteArray()).valid);
+}
+
+void WinManagerBenchmark::postedCommands()
+{
+    // Four threads move their own window in small steps, the GUI thread applies only the last one
+    createWindows(4);
+    class Mover :public QThread
+    {
+    public:
+        WinManager *manager;
+        QPoint start;
+        void run() override
+        {
+            for(int i = 0; i < 1000; ++i)
+                manager->postMove(start+QPoint(i%50,i%30));
+            manager->postResize(QSize(300,200));
+        }
+    };
+    Mover movers[4];
+    for(int i = 0; i < 4; ++i) {
+        movers[i].manager = windows[i].manager;
+        movers[i].start = desktop.topLeft()+QPoint(20+i*60,20);
+        movers[i].start();
+    }
+    for(Mover &m : movers)
+        m.wait();
+    for(int i = 0; i < 4; ++i)
+        QTRY_COMPARE(windows[i].window->geometry(),QRect(movers[i].start+QPoint(999%50,999%30),QSize(300,200)));
+}
+
+void WinManagerBenchmark::controlServer()
+{
+    // A client lists the windows and lays two of them out side by side in one request
+    createWindows(3);
+    QVERIFY(WinManager::listenControl("WinManagerBenchmark"));
+    QLocalSocket client;
+    client.connectToServer("WinManagerBenchmark");
+    QTRY_COMPARE(client.state(),QLocalSocket::ConnectedState);
+    auto request = [&client](const QByteArray &line) {
+        client.write(line+'\n');
+        client.flush();
+        // The server answers from this event loop
+        if(!QTest::qWaitFor([&client]() { return client.canReadLine(); },5000))
+            return QJsonObject();
+        return QJsonDocument::fromJson(client.readLine()).object();
+    };
+    const QJsonArray list = request(R"({"cmd":"list"})").value("windows").toArray();
+    QCOMPARE(list.size(),3);
+    QCOMPARE(list[1].toObject().value("name").toString(),QString("window1"));
+    QCOMPARE(list[1].toObject().value("snap").toString(),QString("none"));
+
+    // Ids are not indices, they still name the same windows after window1 is destroyed
+    const qint64 id0 = qint64(list[0].toObject().value("id").toDouble());
+    const qint64 id1 = qint64(list[1].toObject().value("id").toDouble());
+    const qint64 id2 = qint64(list[2].toObject().value("id").toDouble());
+    delete windows.takeAt(1).window;
+    const QRect left(desktop.x(),desktop.y(),desktop.width()/2,desktop.height());
+    const QRect right(left.right()+1,desktop.y(),desktop.width()-left.width(),desktop.height());
+    auto rect = [](const QRect &r) { return QString("[%1,%2,%3,%4]").arg(r.x()).arg(r.y()).arg(r.width()).arg(r.height()); };
+    const QJsonObject applied = request(QString(R"({"cmd":"apply","windows":[{"id":%1,"geometry":%2},{"id":%3,"geometry":%4}]})")
+                                        .arg(id0).arg(rect(left)).arg(id2).arg(rect(right)).toUtf8());
+    QCOMPARE(applied.value("applied").toInt(),2);
+    QCOMPARE(windows[0].window->geometry(),left);
+    QCOMPARE(windows[1].window->geometry(),right);
+
+    // A bad entry, here the destroyed window, rejects the whole batch
+    QVERIFY(request(QString(R"({"cmd":"apply","windows":[{"id":%1,"snap":"right"},{"id":%2}]})").arg(id0).arg(id1).toUtf8()).contains("error"));
+    QCOMPARE(windows[0].window->geometry(),left);
+    WinManager::closeControl();
+}
+
+int main(int argc, char *argv[])
+{
+    if(!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM","offscreen");
+    QApplication app(argc,argv);
+    WinManagerBenchmark benchmark;
+    QTEST_SET_MAIN_SOURCE_PATH
+    return QTest::qExec(&benchmark,argc,argv);
+}
+
+#include "tst_winmanager.moc"
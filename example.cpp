@@ -7,31 +7,14 @@
 #include "winmanager.h"
 #define cc qDebug()
 
-static QColor average_screen_color;
-// This variable stores the average of the inverted screen color.
-// Value only needs to be updated when pressed as the function is slow
-
-// This function updates it
-void update_average_screen_color()
-{
-    QImage img = qApp->primaryScreen()->grabWindow(static_cast<WId>(qApp->desktop()->screenNumber())).toImage();
-    int r=0,g=0,b=0,rate = 20,w = img.width(),h = img.height(),itc = w*h/(rate*rate);
-
-    for(int i = 0; i < w; i+= rate)
-        for(int j = 0; j < h; j+= rate) {
-            r += img.pixelColor(i,j).red();
-            g += img.pixelColor(i,j).green();
-            b += img.pixelColor(i,j).blue();
-        }
-    average_screen_color = QColor(abs((r/itc)-255),abs((g/itc)-255),abs((b/itc)-255));
-}
-
 void resize_painter(const QWidget *win,QPainter &p)
 {
     QPen pn;
     int w = 3;
     pn.setWidth(w);
-    pn.setColor(average_screen_color);
+    // Inverted average color of the screen around the window, sampled with the SampleScreenColor flag
+    const QColor c = WM::screenColor();
+    pn.setColor(c.isValid() ? QColor(255-c.red(),255-c.green(),255-c.blue()) : QColor(150,150,150));
     pn.setJoinStyle(Qt::MiterJoin);
     p.setPen(pn);
     p.drawRect(2,2,win->width()-w-1,win->height()-w-1);
@@ -47,6 +30,7 @@ void snapPaintFunc(const QWidget *win,QPainter &p)
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
+    WinManager::preloadGeometry();
 
     QWidget w;
     w.setGeometry(0,0,50,50);
@@ -55,8 +39,6 @@ int main(int argc, char *argv[])
 
 //-------------------------------------------------
     WinManager *p = new WinManager(&w);
-    QObject::connect(p,&WinManager::resizeFrameClicked,&a,[](){ update_average_screen_color(); });
-
 
     //p->overrideSideSnapSides(WM::right|WM::left|WM::bottom_right);
 
@@ -64,7 +46,7 @@ int main(int argc, char *argv[])
     p->setMoveCursor(Qt::ClosedHandCursor);
     p->setResizePaintFunction(::resize_painter);
     p->setSnapPaintFunction(::snapPaintFunc);
-    p->overrideFlags(WM::Flag::SaveGeometry|WM::HalfSnap);
+    p->overrideFlags(WM::Flag::SaveGeometry|WM::HalfSnap|WM::SampleScreenColor);
     //p->disableFlags(WM::HalfSnap);
 
 //-------------------------------------------------
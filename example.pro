@@ -29,7 +29,8 @@ SOURCES += \
     winmanager.cpp
 
 HEADERS += \
-    winmanager.h
+    winmanager.h \
+    wmgeometry.h
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
@@ -1,641 +1,2815 @@
 #include "winmanager.h"
-#define cr QCursor::pos()
-#define dsk QGuiApplication::primaryScreen()->availableGeometry()
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QtMath>
+#include <QLayout>
+#include <QPointer>
+#include <QEventLoop>
+#include <QDataStream>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QCryptographicHash>
+#include <QAtomicPointer>
+#ifdef WM_CONTROL_SERVER
+#include <QLocalServer>
+#include <QLocalSocket>
+#endif
+#include <QSharedData>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QWindow>
+#include <QtAlgorithms>
+#include <qdrawutil.h>
+#include <algorithm>
+#include <functional>
+#include <climits>
+
+#define cr cursorPos
 
 #define S_GEOMETRY "__geometry"
+#define S_MAXIMIZED "__maximized"
+#define S_SNAP_SIDE "__snapSide"
+#define S_SNAP_ZONE "__snapZone"
+#define S_LAYOUTS "__layouts"
 
 #define cmd qDebug()
+
+#ifdef WM_NO_METRICS
+#define WM_COUNT(counter)
+#define WM_STAMP(since)
+#define WM_LATENCY(histogram,since)
+#define WM_LATENCY_P(histogram,since)
+#else
+#define WM_COUNT(counter) ++metrics.counter
+#define WM_STAMP(since) since = metricsNow()
+#define WM_LATENCY(histogram,since) recordLatency(metrics.histogram,since)
+#define WM_LATENCY_P(histogram,since) p.recordLatency(p.metrics.histogram,since)
+#endif
 using namespace WM;
 
 class WinManagerPrivate : public QObject
 {
     class ResizeRect;
+    class Overlay;
     friend class WinManager;
+    friend QColor WM::screenColor();
 
-    WinManagerPrivate(WinManager *mainClass,QWidget *window);
+    WinManagerPrivate(WinManager *mainClass,QWidget *window,const WinManagerPrivate *shareWith);
     ~WinManagerPrivate();
 
     WinManager *manager;
     QWidget *window;
-    QWidget *frame;
-    ResizeRect *resizeRect;
+    QWidget *frame; // nullptr with the VirtualFrame flag
+    QColor frameColor; // Color of #frame set by showResizeFrame()
+    bool paintingWindow; // The window is painting itself under the virtual #frame
+    bool frameResizing; // The window is resized by #frame
+    bool frameResizingRect; // The cursor resizes #rect instead of the window
+    QRect rectGeometry; // Global geometry of #rect
+    bool rectVisible;
 
     QCursor oldCursor; // Cursor before moving
-    QCursor movingCursor;
+    bool movingCursorSet; // config->movingCursor is already set for the current drag
+    int frameCursorShape; // Shape last set on #frame by updateCursor(), -1 if unknown
     QRect oldWindowGeometry; // window geometry before maximizing
     QPoint ppos; // Window capture point
     Side pside; // This is for optimization
+    QScreen *pscreen; // Screen of pside
 
     QRect defaultGeometry;
 
-    const char *maximizedButtonProperty; // Pseudo-state of maximize button for CSS
     QAbstractButton *maximizeButton;
     QAbstractButton *minimizeButton;
     QAbstractButton *quitButton;
 
-    int movingArea;
-    int borderWidth; // #frame width
-    int maxX; // Maximum X | Y when changing the window size
-    int maxY;
+    Geometry::Limits limits; // Minimum and maximum size of the window when the resize started
     Side captureSide; // The side where the window was captured
     QPoint offset; // Offset of the cursor relative to the edges of the window when the window is resizing
+    QPoint cursorPos; // Global cursor position of the last mouse event
 
+    enum DragStep
+    {
+        MoveStep = 1,   // Move the window to the cursor
+        ResizeStep = 2, // Resize the window to the cursor
+        RectStep = 4    // Resize #rect to the cursor
+    };
+    int pendingSteps; // Drag steps waiting for the next frame
+    QTimer frameTimer;
+    QElapsedTimer frameClock; // Time since the last applied drag step
+    quint64 coalescedEvents;
+
+    Metrics metrics;
+    QElapsedTimer metricsClock;
+    qint64 eventSince; // Time when the handled mouse event was received, in microseconds
+    qint64 stepsSince; // Time when the oldest pending drag step was queued
+    qint64 paintSince; // Time of the event that changed #rect, -1 once it is painted
+    MetricKind paintKind;
+    inline qint64 metricsNow() const
+    { return metricsClock.nsecsElapsed()/1000; }
+    void recordLatency(Histogram &histogram, qint64 since);
+
+    enum TraceTarget
+    {
+        TraceWindow = 0,       // Event of the window
+        TraceFrame = 1,        // Event of the #frame widget
+        TraceVirtualFrame = 2  // Event of the native window with the VirtualFrame flag
+    };
+    static const quint32 traceMagic = 0x574d5452; // "WMTR"
+    static const quint16 traceVersion = 1;
+    QByteArray trace;
+    QDataStream *recorder; // nullptr when not recording
+    QElapsedTimer recordClock;
+    qint64 lastRecorded; // Time of the last recorded event, in microseconds
+    inline void record(TraceTarget target, QEvent *event)
+    { if(recorder) recordEvent(target,event); }
+    void recordEvent(TraceTarget target, QEvent *event);
+    void startRecording();
+    QByteArray stopRecording();
+    ReplayResult replay(const QByteArray &trace, ReplaySpeed speed);
 
-    Flags flags; // Flags for different settings
-    Sides sideSnapSides; // Sides of desktop to which the window can be snap
-    Sides maximizeSides; // Desktop sides that will maximize the window
     Side currentSnapSide; // Current snap to the desktop side
+    QScreen *snapScreen; // Screen to which the window is snapped
+    int snapZone; // Zone of the snap layout the window is snapped to, -1 if none
+    int pzone; // Zone of the shown #rect, -1 if none
 
+    struct ScreenEntry
+    {
+        QScreen *screen = nullptr;
+        QRect geometry;   // Full geometry of the screen
+        QRect available;  // Available geometry of the screen
+        QRect targets[9]; // Snap rect for each side with HalfSnap, indexed by sideIndex()
+    };
+    class ScreenIndex
+    {
+        // Screens split the virtual desktop into a grid of cells,
+        // so the screen under a point is found by two binary searches
+    public:
+        void addScreen(QScreen *screen);
+        void removeScreen(QScreen *screen);
+        void updateScreen(QScreen *screen);
+        const ScreenEntry &screenAt(const QPoint &point) const;
+        // Returns the screen containing the point, or the nearest one
+        const ScreenEntry &entry(QScreen *screen) const;
+        // Returns the entry of the screen, or of the primary screen if it is not indexed
+    private:
+        QVector<ScreenEntry> screens;
+        QVector<int> xs, ys; // Sorted edges of the grid cells
+        QVector<int> cells;  // Index of the screen covering each cell, or -1
+        static void fill(ScreenEntry &e);
+        void rebuildGrid();
+        const ScreenEntry &nearest(const QPoint &point) const;
+    };
+    class EdgeIndex
+    {
+        // Edges of the visible managed windows sorted by their coordinate, so the edge
+        // nearest to a moving edge is found by a binary search.
+        // The edges of a window are replaced when it moves or resizes
+    public:
+        void update(const WinManagerPrivate *owner, const QRect &rect);
+        void remove(const WinManagerPrivate *owner);
+        int nearestX(int x, int top, int bottom, int distance, const WinManagerPrivate *exclude) const;
+        int nearestY(int y, int left, int right, int distance, const WinManagerPrivate *exclude) const;
+        // Returns the coordinate of the nearest edge crossing the span [top,bottom) or [left,right),
+        // or INT_MIN if there is none within distance. Right and bottom edges are exclusive
+    private:
+        struct Edge
+        {
+            int pos;
+            int from; // Span of the edge on the other axis, [from,to)
+            int to;
+            const WinManagerPrivate *owner;
+            inline bool operator<(const Edge &oth) const
+            { return pos < oth.pos; }
+        };
+        QVector<Edge> xs; // Left and right edges
+        QVector<Edge> ys; // Top and bottom edges
+        QHash<const WinManagerPrivate*,QRect> rects; // Indexed geometry of each window
+        static void insert(QVector<Edge> &edges, const Edge &edge);
+        static void erase(QVector<Edge> &edges, int pos, const WinManagerPrivate *owner);
+        static int nearest(const QVector<Edge> &edges, int pos, int from, int to, int distance, const WinManagerPrivate *exclude);
+    };
+    void updateEdges();
+    // Puts the window in the edge index if it is visible and not maximized, otherwise removes it
+    QRect magnetize(const QRect &rect, Side captured) const;
+    // Moves the rect, or only its captured sides, to the nearest edges of other windows
 
-    PaintFunction paintFunc;
-    PaintFunction resizePaintFunc; // Drawing function #rect
-    PaintFunction snapPaintFunc;   // Drawing function #rect to snap to edge desktop
+    class Animator
+    {
+        // Runs the transitions of all windows on one timer. The frames of a transition are
+        // computed when it starts; on each tick a window jumps to the frame due at that time,
+        // so frames are dropped rather than queued when the GUI thread is late
+    public:
+        Animator();
+        void start(WinManagerPrivate *manager, const QRect &from, const QRect &to, bool sizeOnly,
+                   int interval, int duration, std::function<void()> done);
+        // With sizeOnly only the size is animated, the position stays free for dragging
+        void finish(WinManagerPrivate *manager);
+        // Jumps to the last frame of the transition of the window
+        void remove(WinManagerPrivate *manager);
+        inline bool isRunning(WinManagerPrivate *manager) const
+        { return animations.contains(manager); }
+    private:
+        struct Animation
+        {
+            QVector<QRect> frames;
+            bool sizeOnly;
+            qint64 start;
+            int interval; // Frame interval of the screen of the window, in milliseconds
+            int applied;  // Index of the applied frame
+            std::function<void()> done;
+        };
+        QHash<WinManagerPrivate*,Animation> animations;
+        QTimer timer;
+        QElapsedTimer clock;
+        void tick();
+        void finish(QList<std::function<void()>> &callbacks, WinManagerPrivate *manager);
+    };
+    void animate(const QRect &to, bool sizeOnly, std::function<void()> done = nullptr);
+    void animate(const QRect &from, const QRect &to, bool sizeOnly, std::function<void()> done = nullptr);
+    void applyAnimationFrame(const QRect &rect, bool sizeOnly);
+    inline bool animated() const
+    { return config->flags.testFlag(AnimateTransitions) && window->isVisible(); }
+
+    class Service;
+    Service *service; // Shared by all managed windows
+    quint64 serial; // Identifies the manager for posted commands, never reused
+    const ScreenIndex &screens; // Index of the service
+
+    struct RectPainter
+    {
+        PaintFunction func;
+        PaintCache cache;
+        QPixmap pixmap; // Cached picture of func
+        QColor color;   // Screen color the picture was drawn with
+    };
+    static const int sizeBucket = 32; // Step of the sizes CacheBySize draws pictures for
+    enum ZoneMode
+    {
+        DisabledZone = 0,
+        SnapToZone = 1,
+        MaximizeZone = 2
+    };
+    struct ZoneMap
+    {
+        // Pixel geometry of the zones of the snap layout on one screen. Triggers split
+        // the screen into a grid of cells, so the zone under the cursor is found by two binary searches
+        QRect available; // Available geometry the map is built for
+        QVector<QRect> targets; // Indexed by zone
+        QVector<int> xs, ys; // Sorted edges of the grid cells
+        QVector<int> cells;  // Zone chosen in each cell, or -1
+        void build(const SnapLayout &layout, const QRect &available);
+        int zoneAt(QPoint point) const;
+    };
+    struct Config :public QSharedData
+    {
+        // Settings that windows created with the same WinManager to share with have in common,
+        // until one of them changes its own
+        Flags flags; // Flags for different settings
+        Sides sideSnapSides; // Sides of desktop to which the window can be snap
+        Sides maximizeSides; // Desktop sides that will maximize the window
+        int borderWidth; // #frame width
+        int movingArea;
+        QCursor movingCursor;
+        const char *maximizedButtonProperty; // Pseudo-state of maximize button for CSS
+        RectPainter resizePainter; // Drawing function #rect
+        RectPainter snapPainter;   // Drawing function #rect to snap to edge desktop
+        int sliceMargin;
+        int magnetDistance;
+        int animationDuration; // Milliseconds
+        int resizeBudget; // Microseconds
+        int sampleInterval; // Milliseconds
+        SnapLayout layout;
+        QVector<quint8> zoneModes; // ZoneMode of each zone of layout
+        QHash<QScreen*,ZoneMap> zoneMaps; // Built from layout for each screen, shared as a cache
+    };
+    const ZoneMap &zoneMap(const ScreenEntry &desktop);
+    // Returns the zones on the screen, building them again if its available geometry changed
+    void previewZone();
+    // Shows #rect for the zone under the cursor while moving
+    static Side zoneSide(const QRect &target, const QRect &available);
+    // Returns the side of desktop that the zone covers, which decides where #frame remains
+    QExplicitlySharedDataPointer<Config> config;
+    Config *editConfig();
+    // Separates the configuration of this window from the shared one before changing it
+    RectPainter *rectPainter;  // Painter of the shown #rect, points into config
+    QWidget *paintProxy; // Hidden widget passed to drawing functions to draw pictures of a base size
 
     bool f_moving;
     bool f_start;
 
     inline void clearSideSnap()
-    { currentSnapSide = Side::none; }
-
-    inline void adjustX(QPoint &pos)
-    { if(pos.x() > maxX) pos.setX(maxX); }
-
-    inline void adjustY(QPoint &pos)
-    { if(pos.y() > maxY) pos.setY(maxY); }
+    { currentSnapSide = Side::none; snapZone = -1; }
 
     inline bool windowIsSnapped()
-    { return  currentSnapSide != Side::none; }
+    { return  currentSnapSide != Side::none || snapZone >= 0; }
 
-    static QPoint getOffset(QWidget *window, Side side,const QPoint& pos);
-    // Getting the offset of the point relative to the side of the window
     void resizeWindowToCursor(QWidget *window);   
-
+    QRect resizedToCursor(const QRect &geometry) const;
+    // Returns the geometry with the captured side moved to the cursor
+
+    void queueDragStep(DragStep step);
+    // Runs the step now, or merges it into the next frame if the FramePacing flag is active
+    void flushDragSteps();
+    // Immediately runs all pending drag steps
+    void runDragSteps(int steps);
+    void resizeStep();
+    int frameInterval() const;
+    // Duration of one display frame of the window's screen, in milliseconds
+
+    struct Placement
+    {
+        QRect geometry; // Geometry of the window when it is neither maximized nor snapped
+        bool maximized = false;
+        Side snapSide = Side::none;
+        int snapZone = -1;
+        inline bool operator==(const Placement &oth) const
+        { return geometry == oth.geometry && maximized == oth.maximized && snapSide == oth.snapSide && snapZone == oth.snapZone; }
+    };
+    class GeometryStore;
     void loadWindowGeometry();
+    // Applies the saved geometry, maximization and snap to the window in one pass
+    void screenLayoutChanged();
+    // Restores the placement saved for the new screen layout, if there is one
+    static QString screenLayout();
+    // Returns the fingerprint of the geometries and pixel densities of all screens
     void saveWindowGeometry();
+    // Passes the placement to the GeometryStore, which writes it to QSettings later
     void moveWindow();
     void checkMouseRelease();
     void checkMousePress();
-    void updateCursor(QWidget *window);
+    void updateCursor();
     // Changes the view of the cursor to match the side of the window in which it is located
     void updateFrameMask();
-    // Changes the #frame to fit the size, state, and snap of the window
+    // Changes the #frame to fit the size, state, and snap of the window, if they changed since the last time
+    struct FrameState
+    {
+        QSize size;
+        int border;
+        Side snap;
+        bool maximized;
+        inline bool operator==(const FrameState &oth) const
+        { return size == oth.size && border == oth.border && snap == oth.snap && maximized == oth.maximized; }
+    };
+    FrameState frameState; // What #frame was last fitted to
+    bool frameUpdatePending; // A deferred update of #frame is posted
+    bool frameRaisePending;  // The deferred update also raises #frame above new children
+    void queueFrameUpdate(bool raise = false);
+    // Updates #frame once after the events handled now, however many ask for it meanwhile
+    void createFrame();
+    void updateFrameMode();
+    // Creates or removes the #frame widget according to the VirtualFrame flag
+    void setFlags(Flags flags);
+    void frameEvent(QMouseEvent *event);
+    // Handles a mouse event on #frame, either the widget or the virtual one
+    bool virtualFrameEvent(QEvent *event);
+    // Handles an event of the native window with the VirtualFrame flag
+    void paintVirtualFrame(QEvent *event);
+    static QRegion frameRegion(const QSize &size, int border, Side snap);
+    // Returns the area of #frame in window coordinates
     void minimizeWindow();
     void maximizeWindow();
+    void maximizeFromDrag(const ScreenEntry &desktop);
+    // Maximizes the window released on a maximizing side or zone of desktop
     void quitApp();
-    void deleteResizeRect();
-    void snapWindow(QWidget *window, Side side);
-
-    static Side getDesktopSide(const QPoint &point);
+    void showResizeRect(const QRect &rect, RectPainter *painter);
+    // Shows #rect with the given global geometry on the overlays of the screens it covers
+    void hideResizeRect();
+    Overlay *overlay(QScreen *screen);
+    // Returns the shared overlay of the screen, creating it on first use
+    void paintRect(const QWidget *rect, QPainter &painter);
+    // Draws #rect from the cached picture of its drawing function
+    QPixmap renderRect(PaintFunction func, const QWidget *widget, qreal ratio) const;
+    void snapWindow(QWidget *window, Side side, const ScreenEntry &desktop, bool animate = false);
+
+    enum SystemDrag
+    {
+        NoSystemDrag = 0,
+        SystemMove = 1,
+        SystemResize = 2
+    };
+    SystemDrag systemDrag; // Move or resize done by the window system
+    bool systemDragUnsupported; // The platform refused it once, so it is not asked again
+    QTimer systemDragTimer; // Checks a system drag that stopped changing, see systemDragTimeout()
+    bool startSystemDrag(Side side);
+    // Passes the move (Side::none) or resize to the window system with the SystemMoveResize flag.
+    // Returns false if it is not possible, then the drag continues as usual
+    void systemDragUpdate();
+    // Shows the snap preview for the cursor while the window system moves the window
+    void endSystemDrag();
+    // Snaps and saves the window at the end of the system drag, on the release or when the pointer comes back
+    void systemDragTimeout();
+    // A window held still keeps its drag. A hidden window drops it without snapping or saving
+    void previewSnap();
+    // Shows #rect for the side or zone of desktop under the cursor while moving
+
+    class ColorSampler :public QObject
+    {
+        // Samples the screen around the windows without holding up a drag. The four strips around the
+        // window are grabbed on the GUI thread only when it is idle and no mouse button is down,
+        // and converted and averaged by a worker
+    public:
+        ColorSampler();
+        ~ColorSampler() override;
+        void request(WinManagerPrivate *manager);
+        void cancel(WinManagerPrivate *manager);
+        static QColor average(const QVector<QImage> &images);
+        // Returns the average color of every second row of the images
+    private:
+        static const int margin = 48;         // Width of the sampled ring around the window
+        static const int retryInterval = 100; // Wait while a button is down or #rect is shown
+        QList<WinManagerPrivate*> queue;      // Waiting for the grab
+        QHash<WinManagerPrivate*,quint64> averaging; // Ticket of the sample on the worker
+        quint64 tickets;
+        QTimer idleTimer;
+        QThreadPool worker;
+        void grab();
+        void deliver(WinManagerPrivate *manager, quint64 ticket, const QColor &color);
+    };
+    QColor sampledColor; // Average color of the screen around the window, invalid until sampled
+    QTimer sampleTimer; // Takes the next sample after config->sampleInterval
+    void requestColorSample();
+    // Asks for a new sample of the screen color with the SampleScreenColor flag
+    void colorSampled(const QColor &color);
+
+    ResizeStrategy strategy; // Strategy of the current or last resize
+    qint64 resizeCost; // Average cost of a live resize step in microseconds, 0 if unknown
+    qint64 layoutCost; // Cost of the last resize step until its paint, -1 if not measuring
+    void measurePaint(QEvent *event);
+    // Paints the window now to measure the paint after a live resize step
+    void adaptResize();
+    // Changes the strategy of the current resize to fit resizeCost into the budget
+    void setStrategy(ResizeStrategy s);
+    int stepInterval() const;
+    // Time between drag steps, longer than a frame with ReducedRateResize
+    QRect snapRect(const ScreenEntry &desktop, Side side, const QSize &size) const;
+    // Returns the rect to which a window of the given size snaps on the side of desktop
+
+    inline const ScreenEntry &desktopAt(const QPoint &point) const
+    { return screens.screenAt(point); }
+    inline const ScreenEntry &windowDesktop() const
+    { return screens.screenAt(window->geometry().center()); }
+    // Returns the desktop under the center of the window
+    static int sideIndex(Side side);
+    void removeScreen(QScreen *screen);
+    // Forgets the overlay and snap of a screen that was removed from the index
+
+    inline Side getDesktopSide(const QPoint &point) const
+    { return Geometry::desktopSide(point,desktopAt(point).available); }
+    static inline Side getDesktopSide(const QPoint &point, const ScreenEntry &desktop)
+    { return Geometry::desktopSide(point,desktop.available); }
     // Returns the side of desktop for given coordinates
 
-    void adjustWinForDesktop();
-    // Aligns the window to desktop
+    QRect restoredAt(const QSize &size, int grab) const;
+    // Returns the rect of the window restored to the size under the cursor, within the desktop it lands on
 
     Side getWindowSide(const QPoint &point) const;
     // Returns the side of the window for the given coordinates
 
-    void desktopGeometryChanged(const QRect &);
-    // Handles the desktop resize or position change event
+    struct HitBands
+    {
+        // Area of #frame in window coordinates, the side is found by Geometry::windowSide().
+        // Rebuilt only when the size, snap or state of the window or the width of #frame changes
+        QSize size;
+        int border = -1;
+        Side snap = Side::none;
+        bool maximized = false;
+        QRegion frame; // Area of #frame for the snap of the window
+        void build(const QSize &size, int border, Side snap, bool maximized);
+        Side sideAt(const QPoint &pos) const;
+    };
+    mutable HitBands hitBands;
+    const HitBands &currentHitBands() const;
+    // Returns hitBands, rebuilding them if they are out of date
+    static const Side snapRemap[9][9];
+    // Side of #frame that is actually resized when the window is snapped, indexed by
+    // sideIndex() of the snap side and of the hit side
+
+    void desktopGeometryChanged(QScreen *screen);
+    // Handles the desktop resize or position change event, after the index was updated
 
-    void adjustSnap(const QRect &rect = dsk);
+    void adjustSnap();
     // Aligns the window to the desktop if window is maximized or snap to the side
 
     bool eventFilter(QObject *sender, QEvent *event);
-    class ResizeRect:public QWidget
+    // Handles the events of the window and of its native window
+    bool frameWidgetEvent(QEvent *event);
+    // Handles the events of the #frame widget
+    class SnapshotCover:public QWidget
     {
+        // Covers the window with the stretched snapshot while it is resized with SnapshotResize
     public:
-        // For snap to the desktop side
-        ResizeRect(WinManagerPrivate* parent,const QRect &rect);
-        // For resize
-        ResizeRect(WinManagerPrivate* parent,QWidget *window);
+        SnapshotCover(WinManagerPrivate* parent);
     private:
         WinManagerPrivate& p;
-        QWidget *window;
-        void init();
-        void mouseMoveEvent(QMouseEvent *event) override;
-        void mouseReleaseEvent(QMouseEvent *event) override;
         void paintEvent(QPaintEvent *event) override;
     };
-    class ResizeFrameEF :public QObject
+    SnapshotCover *snapshotCover; // nullptr when not resizing with a snapshot
+    QPixmap snapshot;
+    QList<QPointer<QWidget>> frozenChildren; // Children whose updates are suspended
+    QPointer<QLayout> frozenLayout; // Layout of the window disabled for the snapshot, nullptr if it was already disabled
+    void beginSnapshotResize();
+    // Takes a picture of the window and suspends the layout and painting of its children
+    void endSnapshotResize();
+    // Restores the children and lays them out once for the final size
+    class ResizeRect:public QWidget
+    {
+        // Child of an overlay, geometry is in the coordinates of the overlay.
+        // Moving it only repaints the old and the new area of the overlay.
+        // Draws #rect of the manager that currently owns the overlays
+    public:
+        ResizeRect(Service *service,Overlay *overlay);
+    private:
+        Service &service;
+        void paintEvent(QPaintEvent *event) override;
+    };
+    class Overlay:public QWidget
     {
+        // Transparent window over a whole screen, which is shown and hidden instead of
+        // creating a native window for every #rect. One per screen, shared by all managers
     public:
-
-        ResizeFrameEF(WinManagerPrivate *parent):QObject(parent),p(*parent) {}
+        Overlay(Service *service,QScreen *screen);
+        ResizeRect *rect;
+    };
+    struct Command
+    {
+        enum Kind
+        {
+            Move = 0,
+            Resize = 1,
+            Snap = 2,
+            Maximize = 3,
+            Restore = 4
+        };
+        Kind kind;
+        QPoint pos;
+        QSize size;
+        Side side;
+    };
+    struct CommandPlan
+    {
+        // Outcome of the commands of one window in a batch. A state command supersedes the
+        // earlier moves and resizes, and a move or resize after a snap or maximize restores the window
+        enum State
+        {
+            KeepState = 0,
+            SnapState = 1,
+            MaximizeState = 2,
+            RestoreState = 3
+        };
+        State state = KeepState;
+        Side side = Side::none;
+        bool hasPos = false;
+        bool hasSize = false;
+        QPoint pos;
+        QSize size;
+        void add(const Command &command);
+    };
+    void applyCommands(const CommandPlan &plan);
+    QJsonObject describe() const;
+    // Returns the name, geometry and state of the window for the control endpoint
+    static const char *const sideNames[9]; // Indexed by sideIndex()
+#ifdef WM_CONTROL_SERVER
+    class ControlServer :public QObject
+    {
+        // Local socket endpoint that passes each line received from a client to Service::control()
+        // and writes the reply back as one line
+    public:
+        ControlServer(Service *service);
+        bool listen(const QString &name);
+        QLocalServer server;
     private:
-        WinManagerPrivate& p;
-        bool resizing = false;
+        static const int maxLine = 1 << 20; // Longest request, in bytes
+        Service *service;
+        void connection();
+        void read(QLocalSocket *socket);
+    };
+#endif
+    class CommandQueue
+    {
+        // Lock-free stack of commands. Any number of threads push with a compare-and-swap,
+        // and the GUI thread takes all of them with a single exchange
+    public:
+        ~CommandQueue();
+        bool push(quint64 target, const Command &command);
+        // Returns true if the queue was empty, so the GUI thread has to be woken
+        QVector<QPair<quint64,Command>> take();
+        // Returns all commands in the order they were pushed, with the serial of their manager
+    private:
+        struct Node
+        {
+            quint64 target;
+            Command command;
+            Node *next;
+        };
+        QAtomicPointer<Node> head;
+    };
+    class GeometryStore :public QObject
+    {
+        // Placements of all managed windows of the application, kept in memory for each screen layout
+        // and as the latest one of each window, which is used for layouts not seen before.
+        // QSettings is read once by a worker thread as soon as the store is created, and the changed
+        // placements are written in a single batch when the changes settle, and periodically in case of a crash
+    public:
+        static GeometryStore *instance();
+        static inline GeometryStore *existing()
+        { return store; }
+        Placement placement(const QString &group, const QRect &defaultGeometry);
+        // Returns the placement for the current screen layout, else the latest one.
+        // Waits for the reading to finish if it has not yet
+        bool contains(const QString &group);
+        // Returns whether there is a placement for the current screen layout
+        bool setLayout(const QString &layout);
+        // Changes the current screen layout, returns false if it is the same
+        void setPlacement(const QString &group, const Placement &placement);
+        void flush();
+        // Starts writing the changed placements now
+    private:
+        GeometryStore();
+        ~GeometryStore() override;
+        static GeometryStore *store;
+        static const int settleInterval = 500;     // Delay after the last change before writing
+        static const int periodicInterval = 30000; // Longest time changes wait while they keep coming
+        static QString key(const QString &id, const char *name);
+        // Returns the settings key of the placement id, which is the layout and the group separated by '/'
+        static inline QString id(const QString &layout, const QString &group)
+        { return layout+'/'+group; }
+        void waitForLoad();
+        QString organization;
+        QString application;
+        QString layout; // Fingerprint of the current screen layout
+        QHash<QString,Placement> placements; // Indexed by id
+        QHash<QString,Placement> latest;     // Indexed by group
+        QHash<QString,Placement> changed;    // Placements not written yet, indexed by id
+        QHash<QString,Placement> loaded;     // Filled by the worker, merged by waitForLoad(). Latest ones have an empty layout
+        QSemaphore loadDone;
+        bool loading;
+        QTimer settleTimer;
+        QTimer periodicTimer;
+        QThreadPool writer; // One thread, so the reading and the batches run in order
+    };
+    class Service :public QObject
+    {
+        // One for the application. Filters the events of all managed windows, their #frame widgets
+        // and native windows, and passes them to the manager found in a single dispatch table.
+        // Keeps the only screen index and the only connections to the screen signals
+    public:
+        static Service *instance();
+        void watch(QObject *object, WinManagerPrivate *manager);
+        // Installs the filter on the object and passes its events to the manager
+        void unwatch(WinManagerPrivate *manager);
         bool eventFilter(QObject *sender, QEvent *event) override;
+        ScreenIndex screens;
+        EdgeIndex edges;
+        Animator animator;
+        ColorSampler sampler;
+        const WinManagerPrivate *painting; // Manager whose drawing function runs, for WM::screenColor()
+        void post(quint64 target, const Command &command);
+        // Thread-safe. Queues the command for the manager with the serial and wakes the GUI thread if the queue was empty
+        quint64 serials; // Last serial given to a manager
+        QJsonObject control(const QJsonObject &request);
+        // Handles a request of the control endpoint: {"cmd":"list"} or {"cmd":"apply","windows":[...]}
+        QObject *controlServer; // ControlServer when listening, otherwise nullptr
+        QHash<QScreen*,Overlay*> overlays; // Show #rect, only one manager shows it at a time
+        WinManagerPrivate *rectOwner;      // Manager whose #rect is on the overlays, or nullptr
+    private:
+        Service();
+        ~Service() override;
+        static Service *current;
+        QHash<QObject*,WinManagerPrivate*> targets;
+        QList<WinManagerPrivate*> managers;
+        void forget(QObject *object);
+        void addScreen(QScreen *screen);
+        void removeScreen(QScreen *screen);
+        void screenChanged(QScreen *screen);
+        QTimer layoutTimer; // Waits for a docking or undocking to finish before restoring its layout
+        void updateLayout();
+        CommandQueue commands;
+        QTimer commandTimer; // Delays the next batch of commands to the next display frame
+        QElapsedTimer commandClock; // Time since the last batch
+        void scheduleCommands();
+        void runCommands();
+        void applyPlans(const QList<WinManagerPrivate*> &order, const QHash<WinManagerPrivate*,CommandPlan> &plans);
+        // Applies the commands of all windows together, with their updates suspended meanwhile
     };
 };
 
 void resizePaintFun(const QWidget *win,QPainter &p);
 void snapPaintFun(const QWidget *win,QPainter &p);
 
-WinManagerPrivate::WinManagerPrivate(WinManager *manager,QWidget *win):QObject(manager)
+WinManagerPrivate::WinManagerPrivate(WinManager *manager,QWidget *win,const WinManagerPrivate *shareWith)
+    :QObject(manager),service(Service::instance()),screens(service->screens)
 {
     this->manager = manager;
     window = win;
-    window->setWindowFlags(Qt::FramelessWindowHint|Qt::WindowMinMaxButtonsHint);
-    window->installEventFilter(this);
+    serial = ++service->serials;
+    const Qt::WindowFlags flags = Qt::FramelessWindowHint|Qt::WindowMinMaxButtonsHint;
+    if(window->windowHandle()) {
+        // setWindowFlags() would destroy the existing native window and create it again
+        if((window->windowFlags()&~Qt::WindowType_Mask) != flags) {
+            window->overrideWindowFlags((window->windowFlags()&Qt::WindowType_Mask)|flags);
+            window->windowHandle()->setFlags(window->windowFlags());
+        }
+    }
+    else
+        window->setWindowFlags(flags);
+    if(shareWith)
+        config = shareWith->config;
+    else {
+        config = new Config;
+        config->movingCursor = window->cursor();
+        config->resizePainter = {resizePaintFun,NineSlice,QPixmap()};
+        config->snapPainter = {snapPaintFun,SizeIndependent,QPixmap()};
+        config->sliceMargin = 8;
+        config->maximizedButtonProperty = "isMaximized";
+        config->borderWidth = 3;
+        config->flags = SaveGeometry|DrawResizeRect|HalfSnap|FramePacing;
+        config->sideSnapSides = Side::left|Side::right|bottom|bottom_left|bottom_right|top_left|top_right|top;
+        config->maximizeSides = none;
+        config->movingArea = 0;
+        config->magnetDistance = 12;
+        config->animationDuration = 150;
+        config->resizeBudget = 12000;
+        config->sampleInterval = 2000;
+    }
+    service->watch(window,this);
     maximizeButton = minimizeButton = quitButton = nullptr;
-    resizeRect = nullptr;
+    rectVisible = false;
     frame = nullptr;
+    paintingWindow = frameResizing = frameResizingRect = false;
+    frameState = {QSize(),-1,Side::none,false};
+    frameUpdatePending = frameRaisePending = false;
+    snapshotCover = nullptr;
+    systemDrag = NoSystemDrag;
+    systemDragUnsupported = false;
+    systemDragTimer.setSingleShot(true);
+    systemDragTimer.setInterval(500);
+    connect(&systemDragTimer,&QTimer::timeout,this,&WinManagerPrivate::systemDragTimeout);
+    sampleTimer.setSingleShot(true);
+    connect(&sampleTimer,&QTimer::timeout,this,&WinManagerPrivate::requestColorSample);
+    strategy = LiveResize;
+    resizeCost = 0;
+    layoutCost = -1;
     currentSnapSide = pside = Side::none;
-
-    frame = new QWidget(window);
-    frame->installEventFilter(new WinManagerPrivate::ResizeFrameEF(this));
-    frame->setMouseTracking(true);
+    snapScreen = pscreen = nullptr;
+    snapZone = pzone = -1;
+    if(!config->flags.testFlag(VirtualFrame))
+        createFrame();
 
     f_start = true;
     f_moving = false;
-    movingCursor = window->cursor();
+    pendingSteps = 0;
+    coalescedEvents = 0;
+    metrics = Metrics();
+    metricsClock.start();
+    eventSince = stepsSince = 0;
+    paintSince = -1;
+    paintKind = ResizeMetric;
+    recorder = nullptr;
+    lastRecorded = 0;
+    frameTimer.setSingleShot(true);
+    frameTimer.setTimerType(Qt::PreciseTimer);
+    connect(&frameTimer,&QTimer::timeout,this,&WinManagerPrivate::flushDragSteps);
     oldCursor = window->cursor();
-    resizePaintFunc = resizePaintFun;
-    snapPaintFunc = snapPaintFun;
-    maximizedButtonProperty = "isMaximized";
-    defaultGeometry = QRect(dsk.width()/2-window->width()/2,dsk.height()/2-window->height()/2,window->width(),window->height());
-    borderWidth = 3;
-    flags = SaveGeometry|DrawResizeRect|HalfSnap;
-    sideSnapSides = Side::left|Side::right|bottom|bottom_left|bottom_right|top_left|top_right|top;
-    maximizeSides = none;
-    movingArea = 0;
-    connect(QGuiApplication::primaryScreen(),&QScreen::availableGeometryChanged,this,&WinManagerPrivate::adjustSnap);
+    movingCursorSet = false;
+    frameCursorShape = -1;
+    rectPainter = &config->snapPainter;
+    paintProxy = nullptr;
+    const QRect &ds = screens.entry(QGuiApplication::primaryScreen()).available;
+    defaultGeometry = QRect(ds.width()/2-window->width()/2,ds.height()/2-window->height()/2,window->width(),window->height());
+    // Creating the store starts reading the settings on its worker, so they are ready by the first Show
+    if(config->flags.testFlag(SaveGeometry))
+        GeometryStore::instance();
 }
 
-WinManagerPrivate::~WinManagerPrivate()
+WinManagerPrivate::Config *WinManagerPrivate::editConfig()
 {
-    saveWindowGeometry();
+    const bool resizing = rectPainter == &config->resizePainter;
+    config.detach();
+    rectPainter = resizing ? &config->resizePainter : &config->snapPainter;
+    return config.data();
 }
 
-bool WinManagerPrivate::eventFilter(QObject *sender, QEvent *event)
+WinManagerPrivate::Service *WinManagerPrivate::Service::current = nullptr;
+
+WinManagerPrivate::Service *WinManagerPrivate::Service::instance()
 {
-    switch (event->type())
-    {
-    case QEvent::Resize:
-        updateFrameMask();
-        break;
-    case QEvent::MouseMove:
-        if(f_moving)
-            moveWindow();
-        break;
-    case QEvent::MouseButtonPress:
-        if(static_cast<QMouseEvent *>(event)->button() == Qt::LeftButton)
-            checkMousePress();
-        break;
-    case QEvent::MouseButtonRelease:
-        if(static_cast<QMouseEvent *>(event)->button() == Qt::LeftButton)
-            checkMouseRelease();
-        break;
-    case QEvent::ChildAdded:
-        updateFrameMask();
-        if(frame)
-            frame->raise();
-        break;
-    case QEvent::WindowStateChange:
-    {
-        if(static_cast<QWindowStateChangeEvent*>(event)->oldState() == Qt::WindowMaximized && window->windowState() != Qt::WindowMinimized) {
-            window->setGeometry(oldWindowGeometry);
-            updateFrameMask();
-        }
-        if(maximizeButton) {
-            maximizeButton->setProperty(maximizedButtonProperty,window->isMaximized());
-            maximizeButton->setStyleSheet(maximizeButton->styleSheet());
-        }
-        break;
-    }
-    case QEvent::Show:
-    {
-        if(f_start) {
-            f_start = false;
-            loadWindowGeometry();
-        }
-        adjustSnap();
-        updateFrameMask();
-        break;
-    }
-    default:break;
-    }
-    return QObject::eventFilter(sender,event);
+    if(!current)
+        current = new Service;
+    return current;
 }
-bool WinManagerPrivate::ResizeFrameEF::eventFilter(QObject *sender, QEvent *event)
+
+WinManagerPrivate::Service::Service():QObject(QCoreApplication::instance())
 {
-    Q_UNUSED(sender)
-    QMouseEvent *ev = static_cast<QMouseEvent *>(event);
-    if(ev->type() == QEvent::MouseMove) {
-        if(resizing) {
-            p.resizeWindowToCursor(p.window);
-            if(!p.resizeRect  && getDesktopSide(cr) == top){
-                p.resizeRect = new ResizeRect(&p,QRect(p.window->x(),0,p.window->width(),dsk.height()));
-                p.window->raise();
-            }
-            else if (p.resizeRect && getDesktopSide(cr) != top)
-                p.deleteResizeRect();
-        }
-        else if (ev->buttons() == Qt::NoButton)
-            p.updateCursor(p.frame);
+    painting = nullptr;
+    controlServer = nullptr;
+    rectOwner = nullptr;
+    serials = 0;
+    layoutTimer.setSingleShot(true);
+    layoutTimer.setInterval(250);
+    connect(&layoutTimer,&QTimer::timeout,this,&Service::updateLayout);
+    commandTimer.setSingleShot(true);
+    commandTimer.setTimerType(Qt::PreciseTimer);
+    connect(&commandTimer,&QTimer::timeout,this,&Service::runCommands);
+    for(QScreen *screen : QGuiApplication::screens())
+        addScreen(screen);
+    connect(qApp,&QGuiApplication::screenAdded,this,&Service::addScreen);
+    connect(qApp,&QGuiApplication::screenRemoved,this,&Service::removeScreen);
+}
+
+WinManagerPrivate::Service::~Service()
+{ current = nullptr; }
+
+void WinManagerPrivate::Service::watch(QObject *object, WinManagerPrivate *manager)
+{
+    if(!managers.contains(manager))
+        managers.append(manager);
+    targets.insert(object,manager);
+    object->installEventFilter(this);
+    connect(object,&QObject::destroyed,this,&Service::forget,Qt::UniqueConnection);
+}
+
+void WinManagerPrivate::Service::unwatch(WinManagerPrivate *manager)
+{
+    managers.removeOne(manager);
+    edges.remove(manager);
+    animator.remove(manager);
+    sampler.cancel(manager);
+    if(rectOwner == manager) {
+        for(Overlay *o : overlays)
+            o->hide();
+        rectOwner = nullptr;
     }
-    else if(ev->buttons() == Qt::LeftButton && (ev->type() == QEvent::MouseButtonDblClick || ev->type() == QEvent::MouseButtonPress)) {
-        resizing = true;
-        p.captureSide = p.getWindowSide(cr);
-        p.maxX = p.window->x()+p.window->width()-p.window->minimumWidth();
-        p.maxY = p.window->y()+p.window->height()-p.window->minimumHeight();
-        p.offset = getOffset(p.window,p.captureSide,cr);
-        if(p.manager->testFlag(DrawResizeRect)){
-            p.resizeRect = new ResizeRect(&p,p.window);
-            emit p.manager->resizeFrameClicked();
-        }
+    // The overlays are native windows, they go away with the last managed window
+    if(managers.isEmpty()) {
+        qDeleteAll(overlays);
+        overlays.clear();
     }
-    else if(ev->type() == QEvent::MouseButtonRelease) {
-        if(ev->buttons() == Qt::NoButton)
-            p.updateCursor(p.frame);
-        if(ev->button() != Qt::LeftButton)
-            return true;
-        if(p.resizeRect)
-        {
-            p.window->setGeometry(p.resizeRect->geometry());
-            p.deleteResizeRect();
+    for(auto it = targets.begin(); it != targets.end();) {
+        if(it.value() == manager) {
+            it.key()->removeEventFilter(this);
+            disconnect(it.key(),&QObject::destroyed,this,&Service::forget);
+            it = targets.erase(it);
         }
-        resizing = false;
+        else
+            ++it;
     }
-    return true;
 }
 
-void WinManagerPrivate::updateFrameMask()
+void WinManagerPrivate::Service::forget(QObject *object)
+{ targets.remove(object); }
+
+bool WinManagerPrivate::Service::eventFilter(QObject *sender, QEvent *event)
 {
-    if(!frame) return;
-    if(window->isMaximized()) {
-        frame->resize(0,0);
-        return;
-    }
-    frame->setGeometry(0,0,window->width(),window->height());
-    QRegion reg(frame->geometry());
-    frame->clearMask();
-    switch (currentSnapSide)
-    {
-    case Side::left:
-        frame->setGeometry(window->width()-borderWidth,0,borderWidth,window->height());
-        break;
-    case Side::right:
-        frame->setGeometry(0,0,borderWidth,window->height());
-        break;
-    case Side::top:
-        frame->setGeometry(0,window->height()-borderWidth,window->width(),borderWidth);
-        break;
-    case Side::bottom:
-        frame->setGeometry(0,0,window->width(),borderWidth);
-        break;
-    case Side::top_left:
-        reg -= QRect(0,0,window->width()-borderWidth,window->height()-borderWidth);
-        break;
-    case Side::top_right:
-        reg -= QRect(borderWidth,0,window->width()-borderWidth,window->height()-borderWidth);
-        break;
-    case Side::bottom_left:
-        reg -= QRect(0,borderWidth,window->width()-borderWidth,window->height()-borderWidth);
-        break;
-    case Side::bottom_right:
-        reg -= QRect(borderWidth,borderWidth,window->width()-borderWidth,window->height()-borderWidth);
-        break;
-    default:
-        reg -= QRect(borderWidth,borderWidth,window->width()-borderWidth*2,window->height()-borderWidth*2);
-        break;
-    }
-    frame->setMask(reg);
+    WinManagerPrivate *p = targets.value(sender);
+    if(!p)
+        return false;
+    if(sender == p->frame)
+        return p->frameWidgetEvent(event);
+    return p->eventFilter(sender,event);
 }
 
-void WinManagerPrivate::checkMouseRelease()
+void WinManagerPrivate::Service::addScreen(QScreen *screen)
 {
-    if(f_moving) {
-        window->setCursor(oldCursor);
-        updateCursor(frame);
-        f_moving = false;
-    }
-    if(resizeRect) {
-        // When constructing #rect via the constructor for side snap
-        // it does not catch mouse events and does not remove itself in the mouseRelese method
-        Side s = getDesktopSide(cr);
-        if(maximizeSides&s)
-            window->setWindowState(Qt::WindowMaximized);
-        else {
-            snapWindow(window,s);
-            currentSnapSide = s;
-        }
-        updateFrameMask();
-        deleteResizeRect();
-        frame->setAttribute(Qt::WA_SetCursor, false);
-    }
+    screens.addScreen(screen);
+    connect(screen,&QScreen::availableGeometryChanged,this,[this,screen](){ screenChanged(screen); });
+    connect(screen,&QScreen::geometryChanged,this,[this,screen](){ screenChanged(screen); });
+    connect(screen,&QScreen::logicalDotsPerInchChanged,&layoutTimer,static_cast<void(QTimer::*)()>(&QTimer::start));
+    layoutTimer.start();
 }
 
-void WinManagerPrivate::checkMousePress()
+void WinManagerPrivate::Service::removeScreen(QScreen *screen)
 {
-    if(!movingArea || cr.y() < window->y() + movingArea) {
-        f_moving = true;
-        oldCursor = window->cursor();
-        ppos = window->mapFromGlobal(cr);
-    }
-    if(!window->isMaximized() && !windowIsSnapped())
-        oldWindowGeometry = window->geometry();
+    disconnect(screen,nullptr,this,nullptr);
+    screens.removeScreen(screen);
+    delete overlays.take(screen);
+    for(WinManagerPrivate *p : managers)
+        p->removeScreen(screen);
+    layoutTimer.start();
 }
 
-void WinManagerPrivate::moveWindow()
+void WinManagerPrivate::Service::screenChanged(QScreen *screen)
 {
-    window->setCursor(movingCursor);
-    if(window->isMaximized()) {
-        window->setWindowState(Qt::WindowNoState);
-        window->setGeometry(cr.x()-oldWindowGeometry.width()/2,cr.y()-borderWidth*2,oldWindowGeometry.width(),oldWindowGeometry.height());
-        adjustWinForDesktop();
-        ppos = QPoint(window->mapFromGlobal(cr));
-    }
-    if(windowIsSnapped()) {
-        window->setGeometry(oldWindowGeometry);
-        window->move(cr.x()-window->width()/2,cr.y()-borderWidth);
-        adjustWinForDesktop();
-        ppos = QPoint(window->mapFromGlobal(cr));
-        clearSideSnap();
-        updateFrameMask();
-    }
-    else
-    {
-        Side side = getDesktopSide(cr);
-        if (pside != side)
-        {
-            pside = side;
-            if(!resizeRect)
-                resizeRect = new ResizeRect(this,QRect());
-            if(side &maximizeSides)
-                resizeRect->setGeometry(dsk);
-            else if(side&sideSnapSides) {
-                resizeRect->setGeometry(window->geometry());
-                snapWindow(resizeRect,side);
-            }
-            else {
-                deleteResizeRect();
-                pside = Side::none;
-            }
-        }
-    }
-    window->move(cr-ppos);
+    screens.updateScreen(screen);
+    if(Overlay *o = overlays.value(screen))
+        o->setGeometry(screen->geometry());
+    for(WinManagerPrivate *p : managers)
+        p->desktopGeometryChanged(screen);
+    layoutTimer.start();
 }
 
-void WinManagerPrivate::saveWindowGeometry()
+void WinManagerPrivate::Service::post(quint64 target, const Command &command)
 {
-    QSettings setting(QCoreApplication::organizationName(), QCoreApplication::applicationName(),manager);
-    setting.beginGroup(window->objectName());
-    if(windowIsSnapped() || window->isMaximized())
-        setting.setValue(S_GEOMETRY,oldWindowGeometry);
-    else
-        setting.setValue(S_GEOMETRY,window->geometry());
-    setting.endGroup();
+    if(commands.push(target,command))
+        QMetaObject::invokeMethod(this,[this](){ scheduleCommands(); },Qt::QueuedConnection);
 }
 
-void WinManagerPrivate::loadWindowGeometry()
+void WinManagerPrivate::Service::scheduleCommands()
 {
-    if(!manager->testFlag(SaveGeometry))
+    if(commandTimer.isActive())
         return;
-    if(QCoreApplication::organizationName().isEmpty())
-        QCoreApplication::setOrganizationName(QCoreApplication::applicationName());
-    QSettings setting(QCoreApplication::organizationName(), QCoreApplication::applicationName(),manager);
-    setting.beginGroup(window->objectName());      
-    window->setGeometry(setting.value(S_GEOMETRY,defaultGeometry).toRect());
-    adjustWinForDesktop();
-    adjustSnap();
-    setting.endGroup();}
+    QScreen *screen = QGuiApplication::primaryScreen();
+    qreal rate = screen ? screen->refreshRate() : 0;
+    if(rate <= 0)
+        rate = 60;
+    const qint64 wait = commandClock.isValid() ? qRound(1000/rate)-commandClock.elapsed() : 0;
+    if(wait <= 0)
+        runCommands();
+    else
+        commandTimer.start(static_cast<int>(wait));
+}
 
-void WinManagerPrivate::adjustWinForDesktop()
+void WinManagerPrivate::Service::runCommands()
 {
-    if(window->x() < dsk.x())
-        window->move(dsk.x(),window->y());
-    else if(window->x()+window->width() > dsk.x()+dsk.width())
-        window->move(dsk.x()+dsk.width()-window->width(),window->y());
+    commandClock.start();
+    const QVector<QPair<quint64,Command>> batch = commands.take();
+    if(batch.isEmpty())
+        return;
+    // Serials are never reused, a manager destroyed after posting is not found
+    // even when a new one is allocated at its address
+    QHash<quint64,WinManagerPrivate*> live;
+    for(WinManagerPrivate *p : managers)
+        live.insert(p->serial,p);
+    QHash<WinManagerPrivate*,CommandPlan> plans;
+    QList<WinManagerPrivate*> order;
+    for(const QPair<quint64,Command> &c : batch) {
+        WinManagerPrivate *p = live.value(c.first);
+        if(!p)
+            continue;
+        if(!plans.contains(p))
+            order.append(p);
+        plans[p].add(c.second);
+    }
+    applyPlans(order,plans);
+}
 
-    if(window->y() < dsk.y())
-        window->move(window->x(),dsk.y());
-    else if(window->y()+window->height() > dsk.y()+dsk.height())
-        window->move(window->x(),dsk.y()+dsk.height()-window->height());
+void WinManagerPrivate::Service::applyPlans(const QList<WinManagerPrivate*> &order, const QHash<WinManagerPrivate*,CommandPlan> &plans)
+{
+    for(WinManagerPrivate *p : order)
+        p->window->setUpdatesEnabled(false);
+    for(WinManagerPrivate *p : order)
+        p->applyCommands(plans.value(p));
+    // Each window is painted once, at its final geometry
+    for(WinManagerPrivate *p : order)
+        p->window->setUpdatesEnabled(true);
 }
 
-void WinManagerPrivate::deleteResizeRect()
+WinManagerPrivate::CommandQueue::~CommandQueue()
 {
-    if(resizeRect) {
-        delete resizeRect;
-        resizeRect = nullptr;
+    Node *node = head.fetchAndStoreAcquire(nullptr);
+    while(node) {
+        Node *next = node->next;
+        delete node;
+        node = next;
     }
 }
 
-void WinManagerPrivate::snapWindow(QWidget*window,Side side)
+bool WinManagerPrivate::CommandQueue::push(quint64 target, const Command &command)
 {
-    const QRect &ds = dsk;
-    QSize s = window->size();
-    if(manager->testFlag(WM::HalfSnap))
-        s = QSize(ds.width()/2,ds.height()/2);
+    Node *node = new Node{target,command,nullptr};
+    Node *old = head.loadAcquire();
+    do
+        node->next = old;
+    while(!head.testAndSetRelease(old,node,old));
+    return !old;
+}
 
-    switch (side) {
-    case Side::top:
-        window->setGeometry(ds.x(),ds.y(),ds.width(),s.height());
-        break;
-    case Side::bottom:
-        window->setGeometry(ds.x(),ds.y()+ds.height()-s.height(),ds.width(),s.height());
-        break;
-    case Side::left:
-        window->setGeometry(ds.x(),ds.y(),s.width(),ds.height());
-        break;
-    case Side::right:
-        window->setGeometry(ds.x()+ds.width()-s.width(),ds.y(),s.width(),ds.height());
+QVector<QPair<quint64,Command>> WinManagerPrivate::CommandQueue::take()
+{
+    // The stack is newest first
+    Node *node = head.fetchAndStoreAcquire(nullptr);
+    QVector<QPair<quint64,Command>> result;
+    while(node) {
+        result.append(qMakePair(node->target,node->command));
+        Node *next = node->next;
+        delete node;
+        node = next;
+    }
+    std::reverse(result.begin(),result.end());
+    return result;
+}
+
+void WinManagerPrivate::CommandPlan::add(const Command &command)
+{
+    switch (command.kind) {
+    case Command::Move:
+        hasPos = true;
+        pos = command.pos;
+        if(state == SnapState || state == MaximizeState)
+            state = RestoreState;
         break;
-    case Side::top_left:
-        window->setGeometry(ds.x(),ds.y(),s.width(),s.height());
+    case Command::Resize:
+        hasSize = true;
+        size = command.size;
+        if(state == SnapState || state == MaximizeState)
+            state = RestoreState;
         break;
-    case Side::top_right:
-        window->setGeometry(ds.x()+ds.width()-s.width(),ds.y(),s.width(),s.height());
+    case Command::Snap:
+        state = command.side == Side::none ? RestoreState : SnapState;
+        side = command.side;
+        hasPos = hasSize = false;
         break;
-    case Side::bottom_left:
-        window->setGeometry(ds.x(),ds.y()+ds.height()-s.height(),s.width(),s.height());
+    case Command::Maximize:
+        state = MaximizeState;
+        hasPos = hasSize = false;
         break;
-    case Side::bottom_right:
-        window->setGeometry(ds.x()+ds.width()-s.width(),ds.y()+ds.height()-s.height(),s.width(),s.height());
+    case Command::Restore:
+        state = RestoreState;
+        hasPos = hasSize = false;
         break;
-    default: break;
     }
 }
 
-void WinManagerPrivate::adjustSnap(const QRect& rect)
+void WinManagerPrivate::applyCommands(const CommandPlan &plan)
+{
+    service->animator.finish(this);
+    const bool geometry = plan.hasPos || plan.hasSize;
+    // A maximized or snapped window given a new geometry is restored first, as when it is dragged
+    if(plan.state == CommandPlan::RestoreState || (geometry && plan.state == CommandPlan::KeepState) ||
+            plan.state == CommandPlan::SnapState) {
+        if(window->isMaximized())
+            window->setWindowState(window->windowState()&~Qt::WindowMaximized);
+        else if(windowIsSnapped() && plan.state != CommandPlan::SnapState) {
+            WM_COUNT(geometryApplications);
+            window->setGeometry(oldWindowGeometry);
+        }
+        if(plan.state != CommandPlan::SnapState)
+            clearSideSnap();
+    }
+    if(plan.state == CommandPlan::SnapState) {
+        if(!windowIsSnapped())
+            oldWindowGeometry = window->geometry();
+        const ScreenEntry &d = windowDesktop();
+        snapZone = -1;
+        snapWindow(window,plan.side,d);
+        currentSnapSide = plan.side;
+        snapScreen = d.screen;
+    }
+    else if(plan.state == CommandPlan::MaximizeState && !window->isMaximized()) {
+        if(!windowIsSnapped())
+            oldWindowGeometry = window->geometry();
+        clearSideSnap();
+        window->setWindowState(window->windowState()|Qt::WindowMaximized);
+    }
+    if(geometry) {
+        QRect rect = window->geometry();
+        if(plan.hasSize)
+            rect.setSize(plan.size);
+        if(plan.hasPos)
+            rect.moveTopLeft(plan.pos);
+        WM_COUNT(geometryApplications);
+        window->setGeometry(rect);
+    }
+    updateFrameMask();
+    updateEdges();
+    saveWindowGeometry();
+}
+
+const char *const WinManagerPrivate::sideNames[9] = {
+    "none", "left", "right", "top", "bottom", "bottom_left", "bottom_right", "top_left", "top_right"
+};
+
+static QJsonArray rectToJson(const QRect &rect)
+{ return QJsonArray{rect.x(),rect.y(),rect.width(),rect.height()}; }
+
+QJsonObject WinManagerPrivate::describe() const
+{
+    QJsonObject o;
+    // The serial stays valid while other windows come and go between a list and an apply
+    o["id"] = static_cast<qint64>(serial);
+    o["name"] = window->objectName();
+    o["title"] = window->windowTitle();
+    o["visible"] = window->isVisible();
+    o["geometry"] = rectToJson(window->geometry());
+    o["normalGeometry"] = rectToJson(currentSnapSide != Side::none || snapZone >= 0 || window->isMaximized() ? oldWindowGeometry : window->geometry());
+    o["maximized"] = window->isMaximized();
+    o["minimized"] = window->isMinimized();
+    o["snap"] = sideNames[sideIndex(currentSnapSide)];
+    o["zone"] = snapZone;
+    return o;
+}
+
+QJsonObject WinManagerPrivate::Service::control(const QJsonObject &request)
+{
+    QJsonObject reply;
+    const QString command = request.value("cmd").toString();
+    if(command == "list") {
+        QJsonArray list;
+        for(const WinManagerPrivate *p : managers)
+            list.append(p->describe());
+        reply["windows"] = list;
+        return reply;
+    }
+    if(command != "apply") {
+        reply["error"] = QString("unknown command \"%1\"").arg(command);
+        return reply;
+    }
+    // The whole batch is checked before any window changes
+    QHash<WinManagerPrivate*,CommandPlan> plans;
+    QList<WinManagerPrivate*> order;
+    const QJsonArray entries = request.value("windows").toArray();
+    for(int i = 0; i < entries.size(); ++i) {
+        const QJsonObject e = entries[i].toObject();
+        WinManagerPrivate *p = nullptr;
+        const bool byId = e.contains("id");
+        for(WinManagerPrivate *m : managers)
+            if(byId ? double(m->serial) == e.value("id").toDouble(-1) : m->window->objectName() == e.value("name").toString()) {
+                p = m;
+                break;
+            }
+        if(!p) {
+            reply["error"] = QString("entry %1: no such window").arg(i);
+            return reply;
+        }
+        CommandPlan plan = plans.value(p);
+        if(e.value("restore").toBool())
+            plan.add({Command::Restore,QPoint(),QSize(),Side::none});
+        if(e.value("maximized").toBool())
+            plan.add({Command::Maximize,QPoint(),QSize(),Side::none});
+        if(e.contains("snap")) {
+            const QString name = e.value("snap").toString();
+            const char *const *s = std::find(sideNames,sideNames+9,name);
+            if(s == sideNames+9) {
+                reply["error"] = QString("entry %1: unknown side \"%2\"").arg(i).arg(name);
+                return reply;
+            }
+            plan.add({Command::Snap,QPoint(),QSize(),s == sideNames ? Side::none : static_cast<Side>(1 << (s-sideNames-1))});
+        }
+        if(e.contains("geometry")) {
+            const QJsonArray g = e.value("geometry").toArray();
+            if(g.size() != 4) {
+                reply["error"] = QString("entry %1: geometry is not [x,y,width,height]").arg(i);
+                return reply;
+            }
+            plan.add({Command::Move,QPoint(g[0].toInt(),g[1].toInt()),QSize(),Side::none});
+            plan.add({Command::Resize,QPoint(),QSize(g[2].toInt(),g[3].toInt()),Side::none});
+        }
+        if(!plans.contains(p))
+            order.append(p);
+        plans.insert(p,plan);
+    }
+    applyPlans(order,plans);
+    reply["applied"] = order.size();
+    return reply;
+}
+
+#ifdef WM_CONTROL_SERVER
+WinManagerPrivate::ControlServer::ControlServer(Service *s):QObject(s),service(s)
+{ connect(&server,&QLocalServer::newConnection,this,&ControlServer::connection); }
+
+bool WinManagerPrivate::ControlServer::listen(const QString &name)
+{
+    if(server.listen(name))
+        return true;
+    if(server.serverError() != QAbstractSocket::AddressInUseError)
+        return false;
+    // The socket belongs to a running instance if it answers, else a crashed one left it behind
+    QLocalSocket probe;
+    probe.connectToServer(name);
+    if(probe.waitForConnected(500)) {
+        probe.abort();
+        return false;
+    }
+    QLocalServer::removeServer(name);
+    return server.listen(name);
+}
+
+void WinManagerPrivate::ControlServer::connection()
+{
+    while(QLocalSocket *socket = server.nextPendingConnection()) {
+        connect(socket,&QLocalSocket::readyRead,this,[this,socket](){ read(socket); });
+        connect(socket,&QLocalSocket::disconnected,socket,&QObject::deleteLater);
+    }
+}
+
+void WinManagerPrivate::ControlServer::read(QLocalSocket *socket)
+{
+    while(socket->canReadLine()) {
+        QJsonParseError error;
+        const QJsonDocument request = QJsonDocument::fromJson(socket->readLine(),&error);
+        QJsonObject reply;
+        if(!request.isObject())
+            reply["error"] = error.error != QJsonParseError::NoError ? error.errorString() : QString("request is not an object");
+        else
+            reply = service->control(request.object());
+        socket->write(QJsonDocument(reply).toJson(QJsonDocument::Compact)+'\n');
+    }
+    if(socket->bytesAvailable() > maxLine)
+        socket->abort();
+}
+#endif
+
+void WinManagerPrivate::Service::updateLayout()
+{
+    GeometryStore *store = GeometryStore::existing();
+    if(!store || !store->setLayout(screenLayout()))
+        return;
+    for(WinManagerPrivate *p : managers)
+        p->screenLayoutChanged();
+}
+
+QString WinManagerPrivate::screenLayout()
+{
+    // Sorted, so the order in which the screens were added does not matter
+    QStringList screens;
+    for(QScreen *screen : QGuiApplication::screens()) {
+        const QRect &g = screen->geometry();
+        screens.append(QString("%1,%2,%3x%4@%5:%6").arg(g.x()).arg(g.y()).arg(g.width()).arg(g.height())
+                       .arg(screen->devicePixelRatio()).arg(screen->logicalDotsPerInch()));
+    }
+    screens.sort();
+    return QCryptographicHash::hash(screens.join(';').toUtf8(),QCryptographicHash::Sha1).toHex().left(16);
+}
+
+void WinManagerPrivate::removeScreen(QScreen *screen)
+{
+    config->zoneMaps.remove(screen);
+    if(pscreen == screen)
+        pscreen = nullptr;
+    if(snapScreen == screen) {
+        snapScreen = nullptr;
+        adjustSnap();
+    }
+}
+
+void WinManagerPrivate::desktopGeometryChanged(QScreen *screen)
+{
+    if(!config->layout.isEmpty())
+        zoneMap(screens.entry(screen));
+    if(window->isMaximized() || windowIsSnapped())
+        adjustSnap();
+}
+
+void WinManagerPrivate::ScreenIndex::fill(ScreenEntry &e)
+{
+    e.geometry = e.screen->geometry();
+    e.available = e.screen->availableGeometry();
+    e.targets[sideIndex(Side::none)] = e.available;
+    for(int i = 0; i < 8; ++i) {
+        const Side side = static_cast<Side>(1 << i);
+        e.targets[sideIndex(side)] = Geometry::halfSnapRect(e.available,side);
+    }
+}
+
+void WinManagerPrivate::ScreenIndex::addScreen(QScreen *screen)
+{
+    ScreenEntry e;
+    e.screen = screen;
+    fill(e);
+    screens.append(e);
+    rebuildGrid();
+}
+
+void WinManagerPrivate::ScreenIndex::removeScreen(QScreen *screen)
+{
+    for(int i = 0; i < screens.size(); ++i)
+        if(screens[i].screen == screen) {
+            screens.remove(i);
+            rebuildGrid();
+            return;
+        }
+}
+
+void WinManagerPrivate::ScreenIndex::updateScreen(QScreen *screen)
+{
+    for(ScreenEntry &e : screens)
+        if(e.screen == screen) {
+            const QRect old = e.geometry;
+            fill(e);
+            // Only the full geometry takes part in the grid
+            if(old != e.geometry)
+                rebuildGrid();
+            return;
+        }
+}
+
+void WinManagerPrivate::ScreenIndex::rebuildGrid()
+{
+    xs.clear();
+    ys.clear();
+    for(const ScreenEntry &e : screens) {
+        xs << e.geometry.left() << e.geometry.right()+1;
+        ys << e.geometry.top() << e.geometry.bottom()+1;
+    }
+    std::sort(xs.begin(),xs.end());
+    xs.erase(std::unique(xs.begin(),xs.end()),xs.end());
+    std::sort(ys.begin(),ys.end());
+    ys.erase(std::unique(ys.begin(),ys.end()),ys.end());
+
+    const int cols = qMax(0,xs.size()-1), rows = qMax(0,ys.size()-1);
+    cells.fill(-1,cols*rows);
+    for(int j = 0; j < rows; ++j)
+        for(int i = 0; i < cols; ++i)
+            for(int s = 0; s < screens.size(); ++s)
+                if(screens[s].geometry.contains(xs[i],ys[j])) {
+                    cells[j*cols+i] = s;
+                    break;
+                }
+}
+
+const WinManagerPrivate::ScreenEntry &WinManagerPrivate::ScreenIndex::screenAt(const QPoint &point) const
+{
+    const int cols = xs.size()-1;
+    const int i = static_cast<int>(std::upper_bound(xs.begin(),xs.end(),point.x())-xs.begin())-1;
+    const int j = static_cast<int>(std::upper_bound(ys.begin(),ys.end(),point.y())-ys.begin())-1;
+    if(i >= 0 && i < cols && j >= 0 && j < ys.size()-1) {
+        const int s = cells[j*cols+i];
+        if(s >= 0)
+            return screens[s];
+    }
+    return nearest(point);
+}
+
+const WinManagerPrivate::ScreenEntry &WinManagerPrivate::ScreenIndex::nearest(const QPoint &point) const
+{
+    // Only for points outside of all screens, such as the center of a window dragged off the desktop
+    static const ScreenEntry empty;
+    const ScreenEntry *best = &empty;
+    int bestDistance = INT_MAX;
+    for(const ScreenEntry &e : screens) {
+        const QRect &g = e.geometry;
+        const int dx = qMax(0,qMax(g.left()-point.x(),point.x()-g.right()));
+        const int dy = qMax(0,qMax(g.top()-point.y(),point.y()-g.bottom()));
+        if(dx+dy < bestDistance) {
+            bestDistance = dx+dy;
+            best = &e;
+        }
+    }
+    return *best;
+}
+
+const WinManagerPrivate::ScreenEntry &WinManagerPrivate::ScreenIndex::entry(QScreen *screen) const
+{
+    for(const ScreenEntry &e : screens)
+        if(e.screen == screen)
+            return e;
+    // The screen is gone, so fall back to the primary one
+    QScreen *primary = QGuiApplication::primaryScreen();
+    for(const ScreenEntry &e : screens)
+        if(e.screen == primary)
+            return e;
+    return nearest(QPoint());
+}
+
+int WinManagerPrivate::sideIndex(Side side)
+{
+    // Sides are single bits, so the index is the position of the bit
+    return side == Side::none ? 0 : qCountTrailingZeroBits(static_cast<uint>(side))+1;
+}
+
+WinManagerPrivate::~WinManagerPrivate()
+{
+    saveWindowGeometry();
+    service->unwatch(this);
+    delete paintProxy;
+    delete recorder;
+}
+
+bool WinManagerPrivate::eventFilter(QObject *sender, QEvent *event)
+{
+    if(sender != window)
+        return virtualFrameEvent(event);
+    record(TraceWindow,event);
+    switch (event->type())
+    {
+    case QEvent::Paint:
+        if(!frame && !paintingWindow && frameColor.isValid() && frameColor.alpha()) {
+            paintVirtualFrame(event);
+            return true;
+        }
+        break;
+    case QEvent::UpdateRequest:
+        if(layoutCost >= 0) {
+            measurePaint(event);
+            return true;
+        }
+        break;
+    case QEvent::Resize:
+        if(systemDrag)
+            systemDragUpdate();
+        if(snapshotCover)
+            snapshotCover->resize(window->size());
+        queueFrameUpdate();
+        updateEdges();
+        break;
+    case QEvent::Move:
+        if(systemDrag)
+            systemDragUpdate();
+        updateEdges();
+        break;
+    case QEvent::Hide:
+        sampleTimer.stop();
+        updateEdges();
+        break;
+    case QEvent::Enter:
+        // Pointer events come back to the window when the window system ends the drag
+        endSystemDrag();
+        break;
+    case QEvent::MouseMove:
+        WM_COUNT(mouseEvents);
+        cursorPos = static_cast<QMouseEvent *>(event)->globalPos();
+        if(f_moving)
+            queueDragStep(MoveStep);
+        break;
+    case QEvent::MouseButtonPress:
+        WM_COUNT(mouseEvents);
+        WM_STAMP(eventSince);
+        cursorPos = static_cast<QMouseEvent *>(event)->globalPos();
+        if(static_cast<QMouseEvent *>(event)->button() == Qt::LeftButton)
+            checkMousePress();
+        break;
+    case QEvent::MouseButtonRelease:
+        WM_COUNT(mouseEvents);
+        if(systemDrag) {
+            endSystemDrag();
+            break;
+        }
+        flushDragSteps();
+        WM_STAMP(eventSince);
+        cursorPos = static_cast<QMouseEvent *>(event)->globalPos();
+        if(static_cast<QMouseEvent *>(event)->button() == Qt::LeftButton) {
+            checkMouseRelease();
+            saveWindowGeometry();
+            requestColorSample();
+        }
+        break;
+    case QEvent::ChildAdded:
+        // A window building its interface adds many children in a row
+        queueFrameUpdate(true);
+        break;
+    case QEvent::WindowStateChange:
+    {
+        if(static_cast<QWindowStateChangeEvent*>(event)->oldState() == Qt::WindowMaximized && window->windowState() != Qt::WindowMinimized) {
+            WM_COUNT(geometryApplications);
+            window->setGeometry(oldWindowGeometry);
+            updateFrameMask();
+        }
+        if(maximizeButton) {
+            maximizeButton->setProperty(config->maximizedButtonProperty,window->isMaximized());
+            maximizeButton->setStyleSheet(maximizeButton->styleSheet());
+        }
+        saveWindowGeometry();
+        updateEdges();
+        break;
+    }
+    case QEvent::Show:
+    {
+        // The native window may be new, so the filter for the virtual #frame is installed again
+        if(window->windowHandle())
+            service->watch(window->windowHandle(),this);
+        if(f_start) {
+            f_start = false;
+            // QShowEvent comes before the native window is mapped, so the window is shown once at the
+            // saved placement, with the flags, border and snap layout set by the caller since creation
+            loadWindowGeometry();
+        }
+        adjustSnap();
+        updateFrameMask();
+        updateEdges();
+        requestColorSample();
+        break;
+    }
+    default:break;
+    }
+    return QObject::eventFilter(sender,event);
+}
+bool WinManagerPrivate::frameWidgetEvent(QEvent *event)
+{
+    switch (event->type()) {
+    case QEvent::MouseMove:
+    case QEvent::MouseButtonPress:
+    case QEvent::MouseButtonDblClick:
+    case QEvent::MouseButtonRelease:
+        record(TraceFrame,event);
+        WM_COUNT(mouseEvents);
+        frameEvent(static_cast<QMouseEvent *>(event));
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+void WinManagerPrivate::frameEvent(QMouseEvent *ev)
+{
+    if(ev->type() == QEvent::MouseButtonRelease)
+        flushDragSteps();
+    WM_STAMP(eventSince);
+    cr = ev->globalPos();
+    if(ev->type() == QEvent::MouseMove) {
+        if(frameResizing)
+            queueDragStep(frameResizingRect ? RectStep : ResizeStep);
+        else if (ev->buttons() == Qt::NoButton)
+            updateCursor();
+    }
+    else if(ev->buttons() == Qt::LeftButton && (ev->type() == QEvent::MouseButtonDblClick || ev->type() == QEvent::MouseButtonPress)) {
+        service->animator.finish(this);
+        if(!manager->testFlag(AdaptiveResize))
+            strategy = LiveResize;
+        else if(!manager->testFlag(DrawResizeRect))
+            adaptResize();
+        frameResizing = true;
+        captureSide = getWindowSide(cr);
+        limits = {window->minimumSize(),window->maximumSize()};
+        offset = Geometry::captureOffset(window->geometry(),captureSide,cr);
+        if(captureSide != Side::none && startSystemDrag(captureSide))
+            return;
+        frameResizingRect = manager->testFlag(DrawResizeRect) || (manager->testFlag(AdaptiveResize) && strategy == OutlineResize);
+        if(frameResizingRect){
+            showResizeRect(window->geometry(),&config->resizePainter);
+            emit manager->resizeFrameClicked();
+        }
+        else if(manager->testFlag(SnapshotResize))
+            beginSnapshotResize();
+    }
+    else if(ev->type() == QEvent::MouseButtonRelease) {
+        if(systemDrag) {
+            endSystemDrag();
+            return;
+        }
+        if(ev->buttons() == Qt::NoButton)
+            updateCursor();
+        if(ev->button() != Qt::LeftButton)
+            return;
+        if(rectVisible)
+        {
+            WM_COUNT(geometryApplications);
+            window->setGeometry(rectGeometry);
+            WM_LATENCY(applyLatency[ResizeMetric],eventSince);
+            hideResizeRect();
+        }
+        frameResizing = frameResizingRect = false;
+        endSnapshotResize();
+        // Without live steps the cost is not measured again, so it is lowered to try them on a later resize
+        if(strategy == OutlineResize && manager->testFlag(AdaptiveResize))
+            resizeCost /= 2;
+        saveWindowGeometry();
+        requestColorSample();
+    }
+}
+
+bool WinManagerPrivate::virtualFrameEvent(QEvent *event)
+{
+    if(frame)
+        return false;
+    record(TraceVirtualFrame,event);
+    QMouseEvent *ev = static_cast<QMouseEvent *>(event);
+    switch (event->type()) {
+    case QEvent::Leave:
+        if(!frameResizing) {
+            cr = QCursor::pos();
+            updateCursor();
+        }
+        return false;
+    case QEvent::MouseMove:
+        if(frameResizing) {
+            WM_COUNT(mouseEvents);
+            frameEvent(ev);
+            return true;
+        }
+        if(ev->buttons() == Qt::NoButton)
+            frameEvent(ev);
+        return false;
+    case QEvent::MouseButtonPress:
+    case QEvent::MouseButtonDblClick:
+        // Presses on the border do not reach the child widgets under it
+        if(ev->button() != Qt::LeftButton || getWindowSide(ev->globalPos()) == Side::none)
+            return false;
+        WM_COUNT(mouseEvents);
+        frameEvent(ev);
+        return true;
+    case QEvent::MouseButtonRelease:
+        if(!frameResizing)
+            return false;
+        WM_COUNT(mouseEvents);
+        frameEvent(ev);
+        return true;
+    default:
+        return false;
+    }
+}
+
+void WinManagerPrivate::paintVirtualFrame(QEvent *event)
+{
+    // The window paints itself first, then the border is painted over it, but under the children
+    paintingWindow = true;
+    QCoreApplication::sendEvent(window,event);
+    paintingWindow = false;
+    QPainter painter(window);
+    for(const QRect &rect : currentHitBands().frame)
+        painter.fillRect(rect,frameColor);
+}
+
+void WinManagerPrivate::createFrame()
+{
+    frame = new QWidget(window);
+    service->watch(frame,this);
+    frame->setMouseTracking(true);
+    if(frameColor.isValid()) {
+        frame->setAutoFillBackground(true);
+        frame->setPalette(QPalette(frameColor));
+    }
+    if(window->isVisible())
+        frame->show();
+    frame->raise();
+    frameState = {QSize(),-1,Side::none,false};
+}
+
+void WinManagerPrivate::updateFrameMode()
+{
+    frameCursorShape = -1;
+    if(config->flags.testFlag(VirtualFrame)) {
+        if(!frame)
+            return;
+        delete frame;
+        frame = nullptr;
+        if(window->windowHandle())
+            service->watch(window->windowHandle(),this);
+    }
+    else if(!frame) {
+        createFrame();
+        updateFrameMask();
+    }
+    window->update();
+}
+
+void WinManagerPrivate::setFlags(Flags f)
+{
+    const Flags old = config->flags;
+    if(old == f)
+        return;
+    editConfig()->flags = f;
+    if((old^f)&VirtualFrame)
+        updateFrameMode();
+    if((old^f)&SampleScreenColor) {
+        if(f&SampleScreenColor)
+            requestColorSample();
+        else {
+            sampleTimer.stop();
+            service->sampler.cancel(this);
+            sampledColor = QColor();
+        }
+    }
+}
+
+QRegion WinManagerPrivate::frameRegion(const QSize &s, int bw, Side snap)
+{
+    const int w = s.width(), h = s.height();
+    switch (snap)
+    {
+    case Side::left:
+        return QRegion(w-bw,0,bw,h);
+    case Side::right:
+        return QRegion(0,0,bw,h);
+    case Side::top:
+        return QRegion(0,h-bw,w,bw);
+    case Side::bottom:
+        return QRegion(0,0,w,bw);
+    default:
+        break;
+    }
+    QRegion reg(0,0,w,h);
+    switch (snap)
+    {
+    case Side::top_left:
+        reg -= QRect(0,0,w-bw,h-bw);
+        break;
+    case Side::top_right:
+        reg -= QRect(bw,0,w-bw,h-bw);
+        break;
+    case Side::bottom_left:
+        reg -= QRect(0,bw,w-bw,h-bw);
+        break;
+    case Side::bottom_right:
+        reg -= QRect(bw,bw,w-bw,h-bw);
+        break;
+    default:
+        reg -= QRect(bw,bw,w-bw*2,h-bw*2);
+        break;
+    }
+    return reg;
+}
+
+void WinManagerPrivate::resizeStep()
+{
+    const bool measure = manager->testFlag(AdaptiveResize) && !manager->testFlag(DrawResizeRect);
+    const qint64 start = measure ? metricsNow() : 0;
+    resizeWindowToCursor(window);
+    if(measure)
+        layoutCost = metricsNow()-start;
+    if(!rectVisible && getDesktopSide(cr) == top){
+        const QRect &ds = desktopAt(cr).available;
+        showResizeRect(QRect(window->x(),ds.y(),window->width(),ds.height()),&config->snapPainter);
+        window->raise();
+    }
+    else if (rectVisible && getDesktopSide(cr) != top)
+        hideResizeRect();
+}
+
+void WinManagerPrivate::queueDragStep(DragStep step)
+{
+    WM_STAMP(eventSince);
+    if(!manager->testFlag(FramePacing) && !(strategy == ReducedRateResize && frameResizing)) {
+        runDragSteps(step);
+        return;
+    }
+    if(pendingSteps&step) {
+        ++coalescedEvents;
+        WM_COUNT(coalescedEvents);
+        return;
+    }
+    if(!pendingSteps)
+        stepsSince = eventSince;
+    pendingSteps |= step;
+    if(frameTimer.isActive())
+        return;
+    qint64 wait = frameClock.isValid() ? stepInterval()-frameClock.elapsed() : 0;
+    if(wait <= 0)
+        flushDragSteps();
+    else
+        frameTimer.start(static_cast<int>(wait));
+}
+
+void WinManagerPrivate::flushDragSteps()
+{
+    frameTimer.stop();
+    int steps = pendingSteps;
+    pendingSteps = 0;
+    if(!steps)
+        return;
+    frameClock.start();
+    // Latency is measured from the oldest event merged into this frame
+    eventSince = stepsSince;
+    runDragSteps(steps);
+}
+
+void WinManagerPrivate::runDragSteps(int steps)
+{
+    if(steps&MoveStep && f_moving) {
+        moveWindow();
+        WM_LATENCY(applyLatency[MoveMetric],eventSince);
+    }
+    if(steps&ResizeStep) {
+        resizeStep();
+        WM_LATENCY(applyLatency[ResizeMetric],eventSince);
+    }
+    if(steps&RectStep && rectVisible) {
+        QRect rect = resizedToCursor(rectGeometry);
+        rect.setSize(rect.size().expandedTo(window->minimumSize()).boundedTo(window->maximumSize()));
+        showResizeRect(rect,&config->resizePainter);
+        WM_LATENCY(applyLatency[ResizeMetric],eventSince);
+    }
+}
+
+void WinManagerPrivate::measurePaint(QEvent *event)
+{
+    const qint64 start = metricsNow();
+    static_cast<QObject*>(window)->event(event);
+    const qint64 cost = layoutCost+metricsNow()-start;
+    layoutCost = -1;
+    resizeCost = resizeCost ? (resizeCost*3+cost)/4 : cost;
+    if(frameResizing)
+        adaptResize();
+}
+
+void WinManagerPrivate::adaptResize()
+{
+    const qint64 budget = config->resizeBudget;
+    if(resizeCost > budget*3)
+        setStrategy(OutlineResize);
+    else if(resizeCost > budget)
+        setStrategy(ReducedRateResize);
+    else
+        setStrategy(LiveResize);
+}
+
+void WinManagerPrivate::setStrategy(ResizeStrategy s)
+{
+    if(s == strategy)
+        return;
+    strategy = s;
+    // Switching to #rect in the middle of a resize continues it from the current geometry
+    if(s == OutlineResize && frameResizing && !frameResizingRect) {
+        frameResizingRect = true;
+        showResizeRect(window->geometry(),&config->resizePainter);
+    }
+    emit manager->resizeStrategyChanged(s);
+}
+
+int WinManagerPrivate::stepInterval() const
+{
+    // Half of the time is left to the rest of the application
+    if(strategy == ReducedRateResize && frameResizing)
+        return qMax<int>(frameInterval(),static_cast<int>(resizeCost*2/1000));
+    return frameInterval();
+}
+
+int WinManagerPrivate::frameInterval() const
+{
+    QScreen *screen = window->windowHandle() ? window->windowHandle()->screen() : QGuiApplication::primaryScreen();
+    qreal rate = screen ? screen->refreshRate() : 0;
+    if(rate <= 0)
+        rate = 60;
+    return qMax(1,qRound(1000/rate));
+}
+
+void WinManagerPrivate::queueFrameUpdate(bool raise)
+{
+    if(!frame)
+        return;
+    frameRaisePending |= raise;
+    if(frameUpdatePending)
+        return;
+    frameUpdatePending = true;
+    QMetaObject::invokeMethod(this,[this](){
+        frameUpdatePending = false;
+        updateFrameMask();
+        if(frameRaisePending && frame)
+            frame->raise();
+        frameRaisePending = false;
+    },Qt::QueuedConnection);
+}
+
+void WinManagerPrivate::updateFrameMask()
+{
+    if(!frame) return;
+    const FrameState state = {window->size(),config->borderWidth,currentSnapSide,window->isMaximized()};
+    if(state == frameState)
+        return;
+    frameState = state;
+    WM_COUNT(frameMaskUpdates);
+    if(window->isMaximized()) {
+        frame->resize(0,0);
+        return;
+    }
+    // Along a side #frame is a strip, elsewhere it covers the window and is masked to the border
+    const QRegion reg = frameRegion(window->size(),config->borderWidth,currentSnapSide);
+    const QRect bounds = reg.boundingRect();
+    frame->setGeometry(bounds);
+    frame->setMask(reg.translated(-bounds.topLeft()));
+}
+
+void WinManagerPrivate::checkMouseRelease()
+{
+    if(f_moving) {
+        if(movingCursorSet)
+            window->setCursor(oldCursor);
+        movingCursorSet = false;
+        updateCursor();
+        f_moving = false;
+    }
+    if(rectVisible) {
+        // #rect for side snap does not catch mouse events, so the snap is done here
+        const ScreenEntry &d = desktopAt(cr);
+        Side s = getDesktopSide(cr,d);
+        if(!config->layout.isEmpty()) {
+            const ZoneMap &m = zoneMap(d);
+            const int zone = m.zoneAt(cr);
+            const int mode = zone >= 0 ? config->zoneModes.value(zone) : DisabledZone;
+            // #rect may still show an enabled zone the cursor left, a disabled zone does nothing
+            if(mode == MaximizeZone)
+                maximizeFromDrag(d);
+            else if(mode == SnapToZone) {
+                if(animated())
+                    animate(m.targets[zone],false);
+                else {
+                    WM_COUNT(geometryApplications);
+                    window->setGeometry(m.targets[zone]);
+                }
+                currentSnapSide = zoneSide(m.targets[zone],d.available);
+                snapZone = zone;
+                snapScreen = d.screen;
+            }
+            pzone = -1;
+        }
+        else if(config->maximizeSides&s)
+            maximizeFromDrag(d);
+        else {
+            snapWindow(window,s,d,animated());
+            currentSnapSide = s;
+            snapScreen = d.screen;
+        }
+        WM_LATENCY(applyLatency[SnapMetric],eventSince);
+        updateFrameMask();
+        hideResizeRect();
+        if(frame)
+            frame->setAttribute(Qt::WA_SetCursor, false);
+        frameCursorShape = -1;
+    }
+}
+
+void WinManagerPrivate::checkMousePress()
+{
+    service->animator.finish(this);
+    if(!config->movingArea || cr.y() < window->y() + config->movingArea) {
+        f_moving = true;
+        oldCursor = window->cursor();
+        ppos = window->mapFromGlobal(cr);
+    }
+    if(!window->isMaximized() && !windowIsSnapped())
+        oldWindowGeometry = window->geometry();
+}
+
+void WinManagerPrivate::moveWindow()
+{
+    if(!movingCursorSet) {
+        window->setCursor(config->movingCursor);
+        movingCursorSet = true;
+    }
+    // The restored size is animated while the position follows the cursor
+    const QRect from = window->geometry();
+    if(window->isMaximized()) {
+        window->setWindowState(Qt::WindowNoState);
+        WM_COUNT(geometryApplications);
+        window->setGeometry(restoredAt(oldWindowGeometry.size(),config->borderWidth*2));
+        ppos = QPoint(window->mapFromGlobal(cr));
+        if(animated())
+            animate(from,window->geometry(),true);
+    }
+    if(windowIsSnapped()) {
+        WM_COUNT(geometryApplications);
+        window->setGeometry(restoredAt(oldWindowGeometry.size(),config->borderWidth));
+        ppos = QPoint(window->mapFromGlobal(cr));
+        clearSideSnap();
+        updateFrameMask();
+        if(animated())
+            animate(from,window->geometry(),true);
+    }
+    else if(startSystemDrag(Side::none))
+        return;
+    else
+        previewSnap();
+    WM_COUNT(geometryApplications);
+    if(config->flags.testFlag(MagneticSnap) && pside == Side::none && pzone < 0)
+        window->move(magnetize(QRect(cr-ppos,window->size()),Side::none).topLeft());
+    else
+        window->move(cr-ppos);
+}
+
+void WinManagerPrivate::previewSnap()
+{
+    if(!config->layout.isEmpty()) {
+        previewZone();
+        return;
+    }
+    const ScreenEntry &d = desktopAt(cr);
+    Side side = getDesktopSide(cr,d);
+    if (pside != side || pscreen != d.screen)
+    {
+        pside = side;
+        pscreen = d.screen;
+        if(side &config->maximizeSides)
+            showResizeRect(d.available,&config->snapPainter);
+        else if(side&config->sideSnapSides)
+            showResizeRect(snapRect(d,side,window->size()),&config->snapPainter);
+        else {
+            hideResizeRect();
+            pside = Side::none;
+        }
+    }
+}
+
+bool WinManagerPrivate::startSystemDrag(Side side)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5,15,0)
+    if(systemDragUnsupported || !config->flags.testFlag(SystemMoveResize) || !window->windowHandle())
+        return false;
+    bool started;
+    if(side == Side::none)
+        started = window->windowHandle()->startSystemMove();
+    else {
+        Qt::Edges edges;
+        if(Geometry::hasLeft(side))
+            edges |= Qt::LeftEdge;
+        if(Geometry::hasRight(side))
+            edges |= Qt::RightEdge;
+        if(Geometry::hasTop(side))
+            edges |= Qt::TopEdge;
+        if(Geometry::hasBottom(side))
+            edges |= Qt::BottomEdge;
+        started = window->windowHandle()->startSystemResize(edges);
+    }
+    if(!started) {
+        systemDragUnsupported = true;
+        return false;
+    }
+    // The window system grabs the pointer, so the release may never reach the window
+    systemDrag = side == Side::none ? SystemMove : SystemResize;
+    f_moving = frameResizing = false;
+    if(movingCursorSet) {
+        window->setCursor(oldCursor);
+        movingCursorSet = false;
+    }
+    systemDragTimer.start();
+    return true;
+#else
+    Q_UNUSED(side)
+    return false;
+#endif
+}
+
+void WinManagerPrivate::systemDragUpdate()
+{
+    systemDragTimer.start();
+    if(systemDrag != SystemMove)
+        return;
+    cr = QCursor::pos();
+    previewSnap();
+}
+
+void WinManagerPrivate::endSystemDrag()
+{
+    if(systemDrag == NoSystemDrag)
+        return;
+    systemDragTimer.stop();
+    systemDrag = NoSystemDrag;
+    cr = QCursor::pos();
+    checkMouseRelease();
+    pside = Side::none;
+    pzone = -1;
+    saveWindowGeometry();
+    requestColorSample();
+}
+
+void WinManagerPrivate::systemDragTimeout()
+{
+    if(systemDrag == NoSystemDrag)
+        return;
+    // The user may hold the window still to look at the preview, only a release or Enter commits the drag
+    if(window->isVisible() && !window->isMinimized()) {
+        systemDragTimer.start();
+        return;
+    }
+    systemDrag = NoSystemDrag;
+    hideResizeRect();
+    pside = Side::none;
+    pzone = -1;
+}
+
+void WinManagerPrivate::saveWindowGeometry()
+{
+    if(!config->flags.testFlag(SaveGeometry))
+        return;
+    WM_COUNT(geometrySaves);
+    Placement placement;
+    placement.geometry = windowIsSnapped() || window->isMaximized() ? oldWindowGeometry : window->geometry();
+    placement.maximized = window->isMaximized();
+    placement.snapSide = currentSnapSide;
+    placement.snapZone = snapZone;
+    GeometryStore::instance()->setPlacement(window->objectName(),placement);
+}
+
+void WinManagerPrivate::loadWindowGeometry()
+{
+    if(!config->flags.testFlag(SaveGeometry))
+        return;
+    const Placement placement = GeometryStore::instance()->placement(window->objectName(),defaultGeometry);
+    const ScreenEntry &desktop = screens.screenAt(placement.geometry.center());
+    oldWindowGeometry = Geometry::fitted(placement.geometry,desktop.available);
+    clearSideSnap();
+    if(!placement.maximized && placement.snapZone >= 0 && placement.snapZone < config->layout.size())
+        snapZone = placement.snapZone;
+    else if(!placement.maximized)
+        currentSnapSide = placement.snapSide;
+    snapScreen = windowIsSnapped() ? desktop.screen : nullptr;
+    // A maximized window is restored first, so it can move to the screen of the placement
+    if(window->isMaximized())
+        window->setWindowState(window->windowState()&~Qt::WindowMaximized);
+    WM_COUNT(geometryApplications);
+    window->setGeometry(oldWindowGeometry);
+    if(placement.maximized)
+        window->setWindowState(window->windowState()|Qt::WindowMaximized);
+    adjustSnap();
+    updateEdges();
+}
+
+void WinManagerPrivate::screenLayoutChanged()
+{
+    if(manager->testFlag(SaveGeometry) && GeometryStore::instance()->contains(window->objectName()))
+        loadWindowGeometry();
+}
+
+WinManagerPrivate::GeometryStore *WinManagerPrivate::GeometryStore::store = nullptr;
+
+WinManagerPrivate::GeometryStore *WinManagerPrivate::GeometryStore::instance()
+{
+    if(!store)
+        store = new GeometryStore;
+    return store;
+}
+
+WinManagerPrivate::GeometryStore::GeometryStore():QObject(QCoreApplication::instance())
+{
+    if(QCoreApplication::organizationName().isEmpty())
+        QCoreApplication::setOrganizationName(QCoreApplication::applicationName());
+    organization = QCoreApplication::organizationName();
+    application = QCoreApplication::applicationName();
+    layout = screenLayout();
+
+    class Load :public QRunnable
+    {
+    public:
+        QString organization, application;
+        QHash<QString,Placement> *placements;
+        QSemaphore *done;
+        void run() override
+        {
+            QSettings setting(organization,application);
+            // Latest placements are at the top level, the ones of each layout in S_LAYOUTS/<layout>
+            read(setting,QString());
+            setting.beginGroup(S_LAYOUTS);
+            const QStringList layouts = setting.childGroups();
+            setting.endGroup();
+            for(const QString &layout : layouts)
+                read(setting,layout);
+            done->release();
+        }
+        void read(QSettings &setting, const QString &layout)
+        {
+            if(!layout.isEmpty())
+                setting.beginGroup(QString(S_LAYOUTS)+'/'+layout);
+            QStringList groups = setting.childGroups();
+            groups.prepend(QString());
+            for(const QString &group : groups) {
+                const QString prefix = group.isEmpty() ? QString() : group+'/';
+                if(!setting.contains(prefix+S_GEOMETRY))
+                    continue;
+                Placement &p = (*placements)[id(layout,group)];
+                p.geometry = setting.value(prefix+S_GEOMETRY).toRect();
+                p.maximized = setting.value(prefix+S_MAXIMIZED,false).toBool();
+                p.snapSide = static_cast<Side>(setting.value(prefix+S_SNAP_SIDE,0).toInt());
+                p.snapZone = setting.value(prefix+S_SNAP_ZONE,-1).toInt();
+            }
+            if(!layout.isEmpty())
+                setting.endGroup();
+        }
+    };
+    writer.setMaxThreadCount(1);
+    loading = true;
+    Load *load = new Load;
+    load->organization = organization;
+    load->application = application;
+    load->placements = &loaded;
+    load->done = &loadDone;
+    writer.start(load);
+
+    settleTimer.setSingleShot(true);
+    settleTimer.setInterval(settleInterval);
+    periodicTimer.setSingleShot(true);
+    periodicTimer.setInterval(periodicInterval);
+    connect(&settleTimer,&QTimer::timeout,this,&GeometryStore::flush);
+    connect(&periodicTimer,&QTimer::timeout,this,&GeometryStore::flush);
+    connect(QCoreApplication::instance(),&QCoreApplication::aboutToQuit,this,&GeometryStore::flush);
+}
+
+WinManagerPrivate::GeometryStore::~GeometryStore()
+{
+    // Destroyed with the application object, after all windows have passed their placement
+    flush();
+    writer.waitForDone();
+    store = nullptr;
+}
+
+QString WinManagerPrivate::GeometryStore::key(const QString &id, const char *name)
+{
+    const int slash = id.indexOf('/');
+    const QString layout = id.left(slash), group = id.mid(slash+1);
+    const QString prefix = layout.isEmpty() ? QString() : QString(S_LAYOUTS)+'/'+layout+'/';
+    return group.isEmpty() ? prefix+name : prefix+group+'/'+name;
+}
+
+void WinManagerPrivate::GeometryStore::waitForLoad()
+{
+    if(!loading)
+        return;
+    loadDone.acquire();
+    loading = false;
+    // Placements set while reading are newer than the saved ones
+    for(auto it = loaded.cbegin(); it != loaded.cend(); ++it) {
+        const QString group = it.key().mid(it.key().indexOf('/')+1);
+        if(it.key().startsWith('/')) {
+            if(!latest.contains(group))
+                latest.insert(group,it.value());
+        }
+        else if(!placements.contains(it.key()))
+            placements.insert(it.key(),it.value());
+    }
+    loaded.clear();
+}
+
+WinManagerPrivate::Placement WinManagerPrivate::GeometryStore::placement(const QString &group, const QRect &defaultGeometry)
+{
+    waitForLoad();
+    QHash<QString,Placement>::const_iterator it = placements.constFind(id(layout,group));
+    if(it != placements.cend())
+        return *it;
+    it = latest.constFind(group);
+    if(it != latest.cend())
+        return *it;
+    Placement p;
+    p.geometry = defaultGeometry;
+    return p;
+}
+
+bool WinManagerPrivate::GeometryStore::contains(const QString &group)
+{
+    waitForLoad();
+    return placements.contains(id(layout,group));
+}
+
+bool WinManagerPrivate::GeometryStore::setLayout(const QString &l)
+{
+    if(layout == l)
+        return false;
+    layout = l;
+    return true;
+}
+
+void WinManagerPrivate::GeometryStore::setPlacement(const QString &group, const Placement &placement)
+{
+    const QString i = id(layout,group);
+    QHash<QString,Placement>::iterator it = placements.find(i);
+    if(it != placements.end() && *it == placement)
+        return;
+    placements.insert(i,placement);
+    latest.insert(group,placement);
+    changed.insert(i,placement);
+    settleTimer.start();
+    if(!periodicTimer.isActive())
+        periodicTimer.start();
+}
+
+void WinManagerPrivate::GeometryStore::flush()
+{
+    settleTimer.stop();
+    periodicTimer.stop();
+    if(changed.isEmpty())
+        return;
+    class Batch :public QRunnable
+    {
+    public:
+        QString organization, application;
+        QHash<QString,Placement> placements;
+        void run() override
+        {
+            QSettings setting(organization,application);
+            for(auto it = placements.cbegin(); it != placements.cend(); ++it) {
+                // Each placement is also the latest one of its window
+                const QString ids[2] = {it.key(),id(QString(),it.key().mid(it.key().indexOf('/')+1))};
+                for(const QString &i : ids) {
+                    setting.setValue(key(i,S_GEOMETRY),it->geometry);
+                    setting.setValue(key(i,S_MAXIMIZED),it->maximized);
+                    setting.setValue(key(i,S_SNAP_SIDE),static_cast<int>(it->snapSide));
+                    setting.setValue(key(i,S_SNAP_ZONE),it->snapZone);
+                }
+            }
+            setting.sync();
+        }
+    };
+    Batch *batch = new Batch;
+    batch->organization = organization;
+    batch->application = application;
+    batch->placements.swap(changed);
+    writer.start(batch);
+}
+
+QRect WinManagerPrivate::restoredAt(const QSize &size, int grab) const
+{
+    const QRect rect = Geometry::restored(cr,size,grab);
+    return Geometry::fitted(rect,desktopAt(rect.center()).available);
+}
+
+void WinManagerPrivate::showResizeRect(const QRect &rect, RectPainter *painter)
+{
+    const bool shown = rectVisible;
+    bool repaint = painter != rectPainter;
+    rectPainter = painter;
+    if(service->rectOwner != this) {
+        // The overlays showed #rect of another window
+        if(service->rectOwner)
+            service->rectOwner->rectVisible = false;
+        service->rectOwner = this;
+        repaint = true;
+    }
+    if(!shown) {
+        // Pictures cached by size may depend on state that changes between presses
+        if(config->resizePainter.cache == CacheBySize)
+            config->resizePainter.pixmap = QPixmap();
+        if(config->snapPainter.cache == CacheBySize)
+            config->snapPainter.pixmap = QPixmap();
+    }
+    rectGeometry = rect;
+    rectVisible = true;
+    for(QScreen *screen : QGuiApplication::screens()) {
+        if(!screen->geometry().intersects(rect)) {
+            if(Overlay *o = service->overlays.value(screen))
+                o->hide();
+            continue;
+        }
+        Overlay *o = overlay(screen);
+        o->rect->setGeometry(rect.translated(-o->pos()));
+        if(repaint)
+            o->rect->update();
+        if(!o->isVisible())
+            o->show();
+    }
+    paintSince = eventSince;
+    paintKind = painter == &config->resizePainter ? ResizeMetric : SnapMetric;
+    if(!shown) {
+        WM_COUNT(rectShows);
+        emit manager->sideSnapRectCreated();
+    }
+}
+
+void WinManagerPrivate::hideResizeRect()
+{
+    if(!rectVisible)
+        return;
+    rectVisible = false;
+    for(Overlay *o : service->overlays)
+        o->hide();
+}
+
+void WinManagerPrivate::paintRect(const QWidget *rect, QPainter &painter)
+{
+    RectPainter &rp = *rectPainter;
+    const qreal ratio = rect->devicePixelRatioF();
+    if(rp.color != sampledColor) {
+        // The picture was drawn for another sample or another window sharing the configuration
+        rp.pixmap = QPixmap();
+        rp.color = sampledColor;
+    }
+    if(!rp.pixmap.isNull() && !qFuzzyCompare(rp.pixmap.devicePixelRatio(),ratio))
+        rp.pixmap = QPixmap();
+    switch (rp.cache) {
+    case CacheBySize:
+    {
+        // The size is rounded up to the next step, so a drag draws again only when it crosses one
+        // and otherwise stretches the picture by less than a step
+        const QSize bucket((rect->width()+sizeBucket-1)/sizeBucket*sizeBucket,(rect->height()+sizeBucket-1)/sizeBucket*sizeBucket);
+        if(rp.pixmap.isNull() || rp.pixmap.size() != bucket*ratio) {
+            if(!paintProxy)
+                paintProxy = new QWidget;
+            paintProxy->resize(bucket);
+            rp.pixmap = renderRect(rp.func,paintProxy,ratio);
+        }
+        painter.drawPixmap(rect->rect(),rp.pixmap);
+        break;
+    }
+    case SizeIndependent:
+        if(rp.pixmap.isNull()) {
+            if(!paintProxy)
+                paintProxy = new QWidget;
+            paintProxy->resize(64,64);
+            rp.pixmap = renderRect(rp.func,paintProxy,ratio);
+        }
+        painter.drawPixmap(rect->rect(),rp.pixmap);
+        break;
+    case NineSlice:
+        if(rp.pixmap.isNull()) {
+            if(!paintProxy)
+                paintProxy = new QWidget;
+            paintProxy->resize(config->sliceMargin*2+2,config->sliceMargin*2+2);
+            rp.pixmap = renderRect(rp.func,paintProxy,ratio);
+        }
+        qDrawBorderPixmap(&painter,rect->rect(),QMargins(config->sliceMargin,config->sliceMargin,config->sliceMargin,config->sliceMargin),rp.pixmap);
+        break;
+    }
+}
+
+QPixmap WinManagerPrivate::renderRect(PaintFunction func, const QWidget *widget, qreal ratio) const
+{
+    QPixmap pixmap(widget->size()*ratio);
+    pixmap.setDevicePixelRatio(ratio);
+    pixmap.fill(Qt::transparent);
+    QPainter painter(&pixmap);
+    service->painting = this;
+    func(widget,painter);
+    service->painting = nullptr;
+    return pixmap;
+}
+
+WinManagerPrivate::Overlay *WinManagerPrivate::overlay(QScreen *screen)
+{
+    Overlay *&o = service->overlays[screen];
+    if(!o) {
+        WM_COUNT(rectCreations);
+        o = new Overlay(service,screen);
+    }
+    return o;
+}
+
+void WinManagerPrivate::snapWindow(QWidget*window,Side side,const ScreenEntry &desktop,bool animate)
+{
+    if(side == Side::none)
+        return;
+    if(animate)
+        this->animate(snapRect(desktop,side,window->size()),false);
+    else {
+        WM_COUNT(geometryApplications);
+        window->setGeometry(snapRect(desktop,side,window->size()));
+    }
+}
+
+QRect WinManagerPrivate::snapRect(const ScreenEntry &desktop, Side side, const QSize &size) const
+{
+    if(config->flags.testFlag(WM::HalfSnap) || side == Side::none)
+        return desktop.targets[sideIndex(side)];
+    // Without HalfSnap the window keeps its size and is only anchored to the side
+    return Geometry::snapRect(desktop.available,side,size);
+}
+
+void WinManagerPrivate::adjustSnap()
+{
+    if(window->isMaximized()) {
+        WM_COUNT(geometryApplications);
+        window->setGeometry(windowDesktop().available);
+        if(window->windowState() != Qt::WindowMinimized)
+            window->setWindowState(Qt::WindowState::WindowMaximized);
+    }
+    else if(snapZone >= 0 && snapZone < config->layout.size()) {
+        WM_COUNT(geometryApplications);
+        const ScreenEntry &d = screens.entry(snapScreen);
+        window->setGeometry(zoneMap(d).targets[snapZone]);
+        currentSnapSide = zoneSide(window->geometry(),d.available);
+    }
+    else
+        snapWindow(window,currentSnapSide,screens.entry(snapScreen));
+    updateFrameMask();
+}
+
+const WinManagerPrivate::ZoneMap &WinManagerPrivate::zoneMap(const ScreenEntry &desktop)
+{
+    ZoneMap &m = config->zoneMaps[desktop.screen];
+    if(m.available != desktop.available || m.targets.size() != config->layout.size())
+        m.build(config->layout,desktop.available);
+    return m;
+}
+
+void WinManagerPrivate::previewZone()
+{
+    const ScreenEntry &d = desktopAt(cr);
+    const ZoneMap &m = zoneMap(d);
+    const int zone = m.zoneAt(cr);
+    if(zone == pzone && pscreen == d.screen)
+        return;
+    pzone = zone;
+    pscreen = d.screen;
+    const int mode = zone >= 0 ? config->zoneModes.value(zone) : DisabledZone;
+    if(mode == MaximizeZone)
+        showResizeRect(d.available,&config->snapPainter);
+    else if(mode == SnapToZone)
+        showResizeRect(m.targets[zone],&config->snapPainter);
+    else {
+        hideResizeRect();
+        pzone = -1;
+    }
+}
+
+Side WinManagerPrivate::zoneSide(const QRect &target, const QRect &available)
+{
+    const int l = target.left() <= available.left(), r = target.right() >= available.right();
+    const int t = target.top() <= available.top(), b = target.bottom() >= available.bottom();
+    // Index bits: left, right, top, bottom
+    static const Side sides[16] = {
+        Side::none, Side::none, Side::none, Side::none,
+        Side::none, Side::top_left, Side::top_right, top,
+        Side::none, Side::bottom_left, Side::bottom_right, bottom,
+        Side::none, Side::left, Side::right, Side::none
+    };
+    return sides[l|r<<1|t<<2|b<<3];
+}
+
+void WinManagerPrivate::ZoneMap::build(const SnapLayout &layout, const QRect &ds)
+{
+    available = ds;
+    const auto px = [&ds](qreal f) { return ds.x()+qRound(f*(ds.width()-1)); };
+    const auto py = [&ds](qreal f) { return ds.y()+qRound(f*(ds.height()-1)); };
+    QVector<QVector<QRect>> triggers;
+    targets.clear();
+    xs.clear();
+    ys.clear();
+    for(const SnapZone &zone : layout) {
+        const QRectF &f = zone.target;
+        targets << QRect(QPoint(ds.x()+qRound(f.left()*ds.width()),ds.y()+qRound(f.top()*ds.height())),
+                         QPoint(ds.x()+qRound(f.right()*ds.width())-1,ds.y()+qRound(f.bottom()*ds.height())-1));
+        QVector<QRect> rects;
+        for(const QRectF &t : zone.triggers) {
+            const QRect rect(QPoint(px(t.left()),py(t.top())),QPoint(px(t.right()),py(t.bottom())));
+            rects << rect;
+            xs << rect.left() << rect.right()+1;
+            ys << rect.top() << rect.bottom()+1;
+        }
+        triggers << rects;
+    }
+    std::sort(xs.begin(),xs.end());
+    xs.erase(std::unique(xs.begin(),xs.end()),xs.end());
+    std::sort(ys.begin(),ys.end());
+    ys.erase(std::unique(ys.begin(),ys.end()),ys.end());
+
+    const int cols = qMax(0,xs.size()-1), rows = qMax(0,ys.size()-1);
+    cells.fill(-1,cols*rows);
+    // The first zone of the layout wins where triggers overlap
+    for(int z = triggers.size()-1; z >= 0; --z)
+        for(const QRect &rect : triggers[z]) {
+            const int i0 = static_cast<int>(std::lower_bound(xs.begin(),xs.end(),rect.left())-xs.begin());
+            const int j0 = static_cast<int>(std::lower_bound(ys.begin(),ys.end(),rect.top())-ys.begin());
+            for(int j = j0; j < rows && ys[j] <= rect.bottom(); ++j)
+                for(int i = i0; i < cols && xs[i] <= rect.right(); ++i)
+                    cells[j*cols+i] = z;
+        }
+}
+
+int WinManagerPrivate::ZoneMap::zoneAt(QPoint point) const
+{
+    // The cursor can be beyond the available geometry, for example over a taskbar
+    point.setX(qBound(available.left(),point.x(),available.right()));
+    point.setY(qBound(available.top(),point.y(),available.bottom()));
+    const int cols = xs.size()-1;
+    const int i = static_cast<int>(std::upper_bound(xs.begin(),xs.end(),point.x())-xs.begin())-1;
+    const int j = static_cast<int>(std::upper_bound(ys.begin(),ys.end(),point.y())-ys.begin())-1;
+    if(i >= 0 && i < cols && j >= 0 && j < ys.size()-1)
+        return cells[j*cols+i];
+    return -1;
+}
+
+static SnapLayout cellsLayout(const QVector<qreal> &xs, const QVector<qreal> &ys)
+{
+    // xs and ys are the edges of the columns and rows, from 0 to 1
+    SnapLayout layout;
+    const int cols = xs.size()-1, rows = ys.size()-1;
+    for(int r = 0; r < rows; ++r)
+        for(int c = 0; c < cols; ++c) {
+            SnapZone zone;
+            zone.target = QRectF(QPointF(xs[c],ys[r]),QPointF(xs[c+1],ys[r+1]));
+            if(r == 0)
+                zone.triggers << QRectF(xs[c],0,xs[c+1]-xs[c],0);
+            if(r == rows-1)
+                zone.triggers << QRectF(xs[c],1,xs[c+1]-xs[c],0);
+            if(c == 0)
+                zone.triggers << QRectF(0,ys[r],0,ys[r+1]-ys[r]);
+            if(c == cols-1)
+                zone.triggers << QRectF(1,ys[r],0,ys[r+1]-ys[r]);
+            layout << zone;
+        }
+    return layout;
+}
+
+SnapLayout WM::gridLayout(int columns, int rows)
+{
+    QVector<qreal> xs, ys;
+    for(int i = 0; i <= columns; ++i)
+        xs << qreal(i)/columns;
+    for(int i = 0; i <= rows; ++i)
+        ys << qreal(i)/rows;
+    return columns > 0 && rows > 0 ? cellsLayout(xs,ys) : SnapLayout();
+}
+
+SnapLayout WM::columnsLayout(const QVector<qreal> &widths)
+{
+    QVector<qreal> xs = {0};
+    for(qreal w : widths)
+        xs << xs.last()+w;
+    return widths.isEmpty() ? SnapLayout() : cellsLayout(xs,{0,1});
+}
+
+SnapLayout WM::loadSnapLayout(const QString &fileName)
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly))
+        return SnapLayout();
+    const auto rect = [](const QJsonValue &value, QRectF &result) {
+        const QJsonArray a = value.toArray();
+        if(a.size() != 4)
+            return false;
+        for(const QJsonValue &v : a)
+            if(!v.isDouble())
+                return false;
+        result = QRectF(a[0].toDouble(),a[1].toDouble(),a[2].toDouble(),a[3].toDouble());
+        return true;
+    };
+    SnapLayout layout;
+    for(const QJsonValue &z : QJsonDocument::fromJson(file.readAll()).object().value("zones").toArray()) {
+        SnapZone zone;
+        if(!rect(z.toObject().value("target"),zone.target) || zone.target.isEmpty())
+            return SnapLayout();
+        // Triggers of zero size are edges, so a bad one can only be told by its array
+        for(const QJsonValue &t : z.toObject().value("triggers").toArray()) {
+            QRectF trigger;
+            if(!rect(t,trigger))
+                return SnapLayout();
+            zone.triggers << trigger;
+        }
+        layout << zone;
+    }
+    return layout;
+}
+
+const Side WinManagerPrivate::snapRemap[9][9] = {
+    // none, left, right, top, bottom, bottom_left, bottom_right, top_left, top_right
+    { Side::none, Side::left, Side::right, top, bottom, Side::bottom_left, Side::bottom_right, Side::top_left, Side::top_right },   // none
+    { Side::none, Side::right, Side::right, Side::right, Side::right, Side::right, Side::right, Side::right, Side::right },           // left
+    { Side::none, Side::left, Side::left, Side::left, Side::left, Side::left, Side::left, Side::left, Side::left },                  // right
+    { Side::none, bottom, bottom, bottom, bottom, bottom, bottom, bottom, bottom },                                                  // top
+    { Side::none, top, top, top, top, top, top, top, top },                                                                          // bottom
+    { Side::none, Side::left, Side::right, top, bottom, Side::bottom_left, Side::right, top, Side::top_right },                     // bottom_left
+    { Side::none, Side::left, Side::right, top, bottom, Side::left, Side::bottom_right, Side::top_left, top },                      // bottom_right
+    { Side::none, Side::left, Side::right, top, bottom, bottom, Side::bottom_right, Side::top_left, Side::right },                  // top_left
+    { Side::none, Side::left, Side::right, top, bottom, Side::bottom_left, bottom, Side::left, Side::top_right }                    // top_right
+};
+
+void WinManagerPrivate::HitBands::build(const QSize &s, int bw, Side sn, bool max)
+{
+    size = s;
+    border = bw;
+    snap = sn;
+    maximized = max;
+    frame = max ? QRegion() : frameRegion(s,bw,sn);
+}
+
+Side WinManagerPrivate::HitBands::sideAt(const QPoint &pos) const
+{ return Geometry::windowSide(size,border,pos); }
+
+const WinManagerPrivate::HitBands &WinManagerPrivate::currentHitBands() const
+{
+    const QSize &size = window->size();
+    const bool maximized = window->isMaximized();
+    if(size != hitBands.size || config->borderWidth != hitBands.border || currentSnapSide != hitBands.snap || maximized != hitBands.maximized)
+        hitBands.build(size,config->borderWidth,currentSnapSide,maximized);
+    return hitBands;
+}
+
+Side WinManagerPrivate::getWindowSide(const QPoint& p) const
+{
+    const HitBands &bands = currentHitBands();
+    const QPoint pos = p-window->geometry().topLeft();
+    const Side s = bands.sideAt(pos);
+    if(s == Side::none || !bands.frame.contains(pos))
+        return Side::none;
+    return snapRemap[sideIndex(currentSnapSide)][sideIndex(s)];
+}
+
+void WinManagerPrivate::updateCursor()
+{
+    static const int shapes[9] = {
+        -1, Qt::SizeHorCursor, Qt::SizeHorCursor, Qt::SizeVerCursor, Qt::SizeVerCursor,
+        Qt::SizeBDiagCursor, Qt::SizeFDiagCursor, Qt::SizeFDiagCursor, Qt::SizeBDiagCursor
+    };
+    const int shape = shapes[sideIndex(getWindowSide(cr))];
+    if(frame) {
+        if(shape < 0 || shape == frameCursorShape)
+            return;
+        frameCursorShape = shape;
+        frame->setCursor(static_cast<Qt::CursorShape>(shape));
+        return;
+    }
+    // The virtual #frame sets the cursor of the native window directly,
+    // and gives it back to the widget under the cursor when leaving the border
+    QWindow *handle = window->windowHandle();
+    if(!handle || shape == frameCursorShape)
+        return;
+    frameCursorShape = shape;
+    if(shape < 0) {
+        QWidget *child = window->childAt(window->mapFromGlobal(cr));
+        handle->setCursor((child ? child : window)->cursor());
+    }
+    else
+        handle->setCursor(static_cast<Qt::CursorShape>(shape));
+}
+
+void WinManagerPrivate::resizeWindowToCursor(QWidget *window)
 {
-    if(window->isMaximized()) {
+    if(captureSide == Side::none)
+        return;
+    const QRect rect = resizedToCursor(window->geometry());
+    if(rect != window->geometry()) {
+        WM_COUNT(geometryApplications);
         window->setGeometry(rect);
-        if(window->windowState() != Qt::WindowMinimized)
-            window->setWindowState(Qt::WindowState::WindowMaximized);
     }
+}
+
+QRect WinManagerPrivate::resizedToCursor(const QRect &geometry) const
+{
+    QRect rect = Geometry::resized(geometry,captureSide,cr-offset);
+    if(config->flags.testFlag(MagneticSnap))
+        rect = magnetize(rect,captureSide);
+    return Geometry::constrained(rect,captureSide,limits);
+}
+
+void WinManagerPrivate::updateEdges()
+{
+    if(window->isVisible() && !(window->windowState()&(Qt::WindowMaximized|Qt::WindowMinimized|Qt::WindowFullScreen)))
+        service->edges.update(this,window->geometry());
     else
-        snapWindow(window,currentSnapSide);
-    updateFrameMask();
+        service->edges.remove(this);
 }
 
-Side WinManagerPrivate::getWindowSide(const QPoint& p) const
+QRect WinManagerPrivate::magnetize(const QRect &rect, Side captured) const
 {
-    Side s = Side::none;
-    if(QRect(window->x(),window->y()+borderWidth,borderWidth,window->height()-borderWidth*2).contains(p))
-        s =  Side::left;
-    else if(QRect(window->x()+window->width()-borderWidth,window->y()+borderWidth,borderWidth,window->height()-borderWidth*2).contains(p))
-        s =  Side::right;
-    else if(QRect(window->x()+borderWidth,window->y(),window->width()-borderWidth*2,borderWidth).contains(p))
-        s =  top;
-    else if(QRect(window->x()+borderWidth,window->y()+window->height()-borderWidth,window->width()-borderWidth*2,borderWidth).contains(p))
-        s =  bottom;
-    else if(QRect(window->x(),window->y(),borderWidth,borderWidth).contains(p))
-        s =  Side::top_left;
-    else if(QRect(window->x()+window->width()-borderWidth,window->y(),borderWidth,borderWidth).contains(p))
-        s =  Side::top_right;
-    else if(QRect(window->x()+window->width()-borderWidth,window->y()+window->height()-borderWidth,borderWidth,borderWidth).contains(p))
-        s =  Side::bottom_right;
-    else if(QRect(window->x(),window->y()+window->height()-borderWidth,borderWidth,borderWidth).contains(p))
-        s =  Side::bottom_left;
-
-    if(currentSnapSide != none && s != none)
-    {
-       if(currentSnapSide == top)
-           return  bottom;
-       if (currentSnapSide == bottom)
-           return top;
-       if (currentSnapSide == Side::right)
-           return Side::left;
-       if (currentSnapSide == Side::left)
-           return Side::right;
-       if (currentSnapSide == top_left) {
-           if (s == bottom_left)
-               s = bottom;
-           if (s == top_right)
-               s = Side::right;
-       }
-       if (currentSnapSide == top_right) {
-           if (s == top_left)
-               return Side::left;
-           if (s == bottom_right)
-               return Side::bottom;
-       }
-       if (currentSnapSide == bottom_left) {
-           if (s == top_left)
-               return Side::top;
-           if (s == bottom_right)
-               return Side::right;
-       }
-       if (currentSnapSide == bottom_right) {
-           if (s == bottom_left)
-               return Side::left;
-           if (s == top_right)
-               return Side::top;
-       }
-    }
-    return s;
-}
-
-void WinManagerPrivate::updateCursor(QWidget *widget)
-{
-    switch (getWindowSide(cr))
-    {
-    case Side::left:
-    case Side::right:
-        widget->setCursor(Qt::SizeHorCursor);
-        break;
-    case top:
-    case bottom:
-        widget->setCursor(Qt::SizeVerCursor);
-        break;
-    case Side::bottom_right:
-    case Side::top_left:
-        widget->setCursor(Qt::SizeFDiagCursor);
-        break;
-    case Side::bottom_left:
-    case Side::top_right:
-        widget->setCursor(Qt::SizeBDiagCursor);
-        break;
-    case Side::none:
-        break;
-    }
+    const EdgeIndex &edges = service->edges;
+    const int d = config->magnetDistance;
+    const int x1 = rect.x(), x2 = rect.x()+rect.width();
+    const int y1 = rect.y(), y2 = rect.y()+rect.height();
+    const bool moving = captured == Side::none;
+    const bool l = moving || Geometry::hasLeft(captured);
+    const bool r = moving || Geometry::hasRight(captured);
+    const bool t = moving || Geometry::hasTop(captured);
+    const bool b = moving || Geometry::hasBottom(captured);
+
+    // Shift of the nearest of the given edges, INT_MAX if none is close
+    int dx = INT_MAX, dy = INT_MAX;
+    int e;
+    if(l && (e = edges.nearestX(x1,y1,y2,d,this)) != INT_MIN)
+        dx = e-x1;
+    if(r && (e = edges.nearestX(x2,y1,y2,d,this)) != INT_MIN && qAbs(e-x2) < qAbs(dx))
+        dx = e-x2;
+    if(t && (e = edges.nearestY(y1,x1,x2,d,this)) != INT_MIN)
+        dy = e-y1;
+    if(b && (e = edges.nearestY(y2,x1,x2,d,this)) != INT_MIN && qAbs(e-y2) < qAbs(dy))
+        dy = e-y2;
+    if(dx == INT_MAX)
+        dx = 0;
+    if(dy == INT_MAX)
+        dy = 0;
+
+    if(moving)
+        return rect.translated(dx,dy);
+    QRect result = rect;
+    if(l)
+        result.setLeft(x1+dx);
+    else if(r)
+        result.setRight(rect.right()+dx);
+    if(t)
+        result.setTop(y1+dy);
+    else if(b)
+        result.setBottom(rect.bottom()+dy);
+    return result;
 }
 
-QPoint WinManagerPrivate::getOffset(QWidget *window, Side side, const QPoint &pos)
+void WinManagerPrivate::EdgeIndex::insert(QVector<Edge> &edges, const Edge &edge)
+{ edges.insert(std::upper_bound(edges.begin(),edges.end(),edge),edge); }
+
+void WinManagerPrivate::EdgeIndex::erase(QVector<Edge> &edges, int pos, const WinManagerPrivate *owner)
 {
-    QPoint offset(0,0);
-    if(side == Side::left || side == Side::top_left || side == Side::bottom_left)
-        offset.setX( pos.x()-window->x());
-    if(side == Side::right || side == Side::top_right || side == Side::bottom_right)
-        offset.setX( pos.x()-(window->x()+window->width()));
-    if(side == top || side == Side::top_left || side == Side::top_right)
-        offset.setY( pos.y()-window->y());
-    if(side == bottom ||side == Side::bottom_left || side == Side::bottom_right)
-        offset.setY( pos.y()-(window->y()+window->height()));
-    return offset;
+    const Edge key = {pos,0,0,nullptr};
+    for(auto it = std::lower_bound(edges.begin(),edges.end(),key); it != edges.end() && it->pos == pos; ++it)
+        if(it->owner == owner) {
+            edges.erase(it);
+            return;
+        }
 }
 
-void WinManagerPrivate::resizeWindowToCursor(QWidget *window)
+void WinManagerPrivate::EdgeIndex::update(const WinManagerPrivate *owner, const QRect &rect)
 {
-    QPoint p = cr-offset;
-    switch (captureSide) {
-    case Side::right:
-        window->resize(p.x()-window->x(),window->height());
-        break;
-    case bottom:
-        window->resize(window->width(),p.y()-window->y());
-        break;
-    case Side::bottom_right:
-        window->resize(p.x()-window->x(),p.y()-window->y());
-        break;
-    case Side::left:
-        adjustX(p);
-        window->setGeometry(p.x(),window->y(),window->x()+window->width()-p.x(),window->height());
-        break;
-    case top:
-        adjustY(p);
-        window->setGeometry(window->x(),p.y(),window->width(),window->y()+window->height()-p.y());
-        break;
-    case Side::top_right:
-        adjustY(p);
-        window->setGeometry(window->x(),p.y(),p.x()-window->x(),window->y()+window->height()-p.y());
-        break;
-    case Side::bottom_left:
-        adjustX(p);
-        window->setGeometry(p.x(),window->y(),window->x()+window->width()-p.x(),p.y()-window->y());
-        break;
-    case Side::top_left:
-        adjustX(p);
-        adjustY(p);
-        window->setGeometry(p.x(),p.y(),window->x()+window->width()-p.x(),window->y()+window->height()-p.y());
-        break;
-    case Side::none:
-        break;
+    auto it = rects.find(owner);
+    if(it != rects.end()) {
+        if(*it == rect)
+            return;
+        remove(owner);
     }
+    const int x1 = rect.x(), x2 = rect.x()+rect.width();
+    const int y1 = rect.y(), y2 = rect.y()+rect.height();
+    insert(xs,{x1,y1,y2,owner});
+    insert(xs,{x2,y1,y2,owner});
+    insert(ys,{y1,x1,x2,owner});
+    insert(ys,{y2,x1,x2,owner});
+    rects.insert(owner,rect);
 }
 
-Side WinManagerPrivate::getDesktopSide(const QPoint &point)
+void WinManagerPrivate::EdgeIndex::remove(const WinManagerPrivate *owner)
 {
-    if(point.x() <= dsk.x() && point.y() <= dsk.y())
-        return Side::top_left;
-    if(point.x() >= dsk.x()+dsk.width()-1 && point.y() <= dsk.y())
-        return Side::top_right;
-    if(point.x() <= dsk.x() && point.y() >= dsk.y()+dsk.height()-1)
-        return Side::bottom_left;
-    if(point.x() >= dsk.x()+dsk.width()-1 && point.y() >= dsk.y()+dsk.height()-1)
-        return Side::bottom_right;
-    if(point.x() == dsk.x() && point.y() == dsk.y())
-        return Side::top_left;
-    if(point.x() <= dsk.x())
-        return Side::left;
-    if(point.x() >= dsk.x()+dsk.width()-1)
-        return Side::right;
-    if(point.y() <= dsk.y())
-        return top;
-    if(point.y() >= dsk.y()+dsk.height()-1)
-        return bottom;
+    const QRect rect = rects.take(owner);
+    if(rect.isNull())
+        return;
+    erase(xs,rect.x(),owner);
+    erase(xs,rect.x()+rect.width(),owner);
+    erase(ys,rect.y(),owner);
+    erase(ys,rect.y()+rect.height(),owner);
+}
 
-    return Side::none;
+int WinManagerPrivate::EdgeIndex::nearest(const QVector<Edge> &edges, int pos, int from, int to, int distance, const WinManagerPrivate *exclude)
+{
+    const Edge key = {pos-distance,0,0,nullptr};
+    int best = INT_MIN, bestDistance = distance+1;
+    for(auto it = std::lower_bound(edges.begin(),edges.end(),key); it != edges.end() && it->pos <= pos+distance; ++it)
+        // Spans closer than distance also count, so windows stacked next to each other align
+        if(it->owner != exclude && it->from < to+distance && from-distance < it->to && qAbs(it->pos-pos) < bestDistance) {
+            best = it->pos;
+            bestDistance = qAbs(it->pos-pos);
+        }
+    return best;
 }
 
+int WinManagerPrivate::EdgeIndex::nearestX(int x, int top, int bottom, int distance, const WinManagerPrivate *exclude) const
+{ return nearest(xs,x,top,bottom,distance,exclude); }
+
+int WinManagerPrivate::EdgeIndex::nearestY(int y, int left, int right, int distance, const WinManagerPrivate *exclude) const
+{ return nearest(ys,y,left,right,distance,exclude); }
+
 void resizePaintFun(const QWidget *win,QPainter &p)
 {
-    QPen pn;
-    pn.setWidth(5);
-    pn.setColor(Qt::black);
-    pn.setJoinStyle(Qt::MiterJoin);
+    static const QPen pn(QBrush(Qt::black),5,Qt::SolidLine,Qt::SquareCap,Qt::MiterJoin);
     p.setPen(pn);
     p.drawRect(2,2,win->width()-5,win->height()-5);
 }
@@ -649,54 +2823,91 @@ void snapPaintFun(const QWidget *win,QPainter &p)
 
 void WinManagerPrivate::ResizeRect::paintEvent(QPaintEvent*)
 {
+    if(!service.rectOwner)
+        return;
+    WinManagerPrivate &p = *service.rectOwner;
     QPainter painter(this);
-    p.paintFunc(this,painter);
+    p.paintRect(this,painter);
+    if(p.paintSince >= 0) {
+        WM_LATENCY_P(paintLatency[p.paintKind],p.paintSince);
+        p.paintSince = -1;
+    }
 }
 
-WinManagerPrivate::ResizeRect::ResizeRect(WinManagerPrivate* parent,QWidget *win):p(*parent)
+WinManagerPrivate::ResizeRect::ResizeRect(Service *service,Overlay *overlay):QWidget(overlay),service(*service)
 {
-    init();
-    window = win;
-    p.paintFunc = p.resizePaintFunc;
+    setAttribute(Qt::WA_TransparentForMouseEvents,true);
+}
 
-    setMinimumSize(window->minimumSize());
-    setGeometry(window->geometry());
-    setMouseTracking(true);
-    p.updateCursor(this);
-    grabMouse();
-    setFocus();
+WinManagerPrivate::SnapshotCover::SnapshotCover(WinManagerPrivate* parent):QWidget(parent->window),p(*parent)
+{
+    setAttribute(Qt::WA_TransparentForMouseEvents,true);
+    setAttribute(Qt::WA_OpaquePaintEvent,!parent->window->testAttribute(Qt::WA_TranslucentBackground));
+    setGeometry(parent->window->rect());
 }
 
-void WinManagerPrivate::ResizeRect::init()
+void WinManagerPrivate::SnapshotCover::paintEvent(QPaintEvent*)
 {
-    setAttribute(Qt::WA_TranslucentBackground,true);
-    setWindowFlags(Qt::FramelessWindowHint|Qt::Tool);
-    show();
-    emit p.manager->sideSnapRectCreated();
+    QPainter painter(this);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform,false);
+    painter.drawPixmap(rect(),p.snapshot);
 }
 
-WinManagerPrivate::ResizeRect::ResizeRect(WinManagerPrivate* parent, const QRect &rect):p(*parent)
+void WinManagerPrivate::beginSnapshotResize()
 {
-    init();
-    p.paintFunc = p.snapPaintFunc;
-    setGeometry(rect);
+    if(snapshotCover)
+        return;
+    snapshot = window->grab();
+    for(QWidget *child : window->findChildren<QWidget*>(QString(),Qt::FindDirectChildrenOnly))
+        if(child != frame && child->isVisible() && child->updatesEnabled()) {
+            child->setUpdatesEnabled(false);
+            frozenChildren << child;
+        }
+    // A layout the application disabled itself stays disabled afterwards
+    if(window->layout() && window->layout()->isEnabled()) {
+        frozenLayout = window->layout();
+        frozenLayout->setEnabled(false);
+    }
+    snapshotCover = new SnapshotCover(this);
+    snapshotCover->show();
+    snapshotCover->raise();
+    if(frame)
+        frame->raise();
 }
 
-void WinManagerPrivate::ResizeRect::mouseReleaseEvent(QMouseEvent *event)
+void WinManagerPrivate::endSnapshotResize()
 {
-    if(event->button() != Qt::LeftButton) return;
-    QApplication::sendEvent(p.frame,event);
-    window->setGeometry(geometry());
-    p.deleteResizeRect();
+    if(!snapshotCover)
+        return;
+    delete snapshotCover;
+    snapshotCover = nullptr;
+    snapshot = QPixmap();
+    for(const QPointer<QWidget> &child : frozenChildren)
+        if(child)
+            child->setUpdatesEnabled(true);
+    frozenChildren.clear();
+    if(frozenLayout) {
+        frozenLayout->setEnabled(true);
+        frozenLayout->activate();
+        frozenLayout = nullptr;
+    }
+    window->update();
 }
 
-void WinManagerPrivate::ResizeRect::mouseMoveEvent(QMouseEvent *event)
+WinManagerPrivate::Overlay::Overlay(Service *service,QScreen *screen)
 {
-    Q_UNUSED(event)
-    p.resizeWindowToCursor(this);
+    setAttribute(Qt::WA_TranslucentBackground,true);
+    setAttribute(Qt::WA_TransparentForMouseEvents,true);
+    setAttribute(Qt::WA_ShowWithoutActivating,true);
+    setWindowFlags(Qt::FramelessWindowHint|Qt::Tool|Qt::WindowTransparentForInput|Qt::WindowDoesNotAcceptFocus);
+    setGeometry(screen->geometry());
+    rect = new ResizeRect(service,this);
+    create();
+    windowHandle()->setScreen(screen);
 }
 
-WinManager::WinManager(QWidget *window):QObject (window),p(new WinManagerPrivate(this,window)) { }
+WinManager::WinManager(QWidget *window, const WinManager *shareWith)
+    :QObject (window),p(new WinManagerPrivate(this,window,shareWith ? shareWith->p : nullptr)) { }
 
 WinManager::~WinManager() { }
 
@@ -707,13 +2918,299 @@ void WinManagerPrivate::minimizeWindow()
 }
 void WinManagerPrivate::maximizeWindow()
 {
-    if(window->isMaximized())
+    const QRect from = window->geometry();
+    const bool restore = window->isMaximized();
+    if(restore)
         window->setWindowState(Qt::WindowState::WindowNoState);
-    else
+    else if(!animated())
         window->setWindowState(Qt::WindowState::WindowMaximized);
     if(!windowIsSnapped())
         oldWindowGeometry = window->geometry();
     clearSideSnap();
+    if(!animated())
+        return;
+    if(restore)
+        animate(from,window->geometry(),false);
+    else // The state changes when the window has reached the desktop
+        animate(windowDesktop().available,false,[this](){ window->setWindowState(Qt::WindowMaximized); });
+}
+
+void WinManagerPrivate::maximizeFromDrag(const ScreenEntry &desktop)
+{
+    if(animated())
+        animate(desktop.available,false,[this](){ window->setWindowState(Qt::WindowMaximized); });
+    else
+        window->setWindowState(Qt::WindowMaximized);
+}
+
+void WinManagerPrivate::animate(const QRect &to, bool sizeOnly, std::function<void()> done)
+{ animate(window->geometry(),to,sizeOnly,done); }
+
+void WinManagerPrivate::animate(const QRect &from, const QRect &to, bool sizeOnly, std::function<void()> done)
+{ service->animator.start(this,from,to,sizeOnly,frameInterval(),config->animationDuration,done); }
+
+void WinManagerPrivate::applyAnimationFrame(const QRect &rect, bool sizeOnly)
+{
+    WM_COUNT(geometryApplications);
+    if(sizeOnly)
+        window->resize(rect.size());
+    else
+        window->setGeometry(rect);
+}
+
+WinManagerPrivate::Animator::Animator()
+{
+    timer.setTimerType(Qt::PreciseTimer);
+    QObject::connect(&timer,&QTimer::timeout,&timer,[this](){ tick(); });
+    clock.start();
+}
+
+void WinManagerPrivate::Animator::start(WinManagerPrivate *manager, const QRect &from, const QRect &to, bool sizeOnly,
+                                        int interval, int duration, std::function<void()> done)
+{
+    finish(manager);
+    Animation a;
+    a.sizeOnly = sizeOnly;
+    a.start = clock.elapsed();
+    a.interval = qMax(1,interval);
+    a.applied = 0;
+    a.done = done;
+    // Ease out: fast at the start, slowing down at the target
+    const int count = qMax(1,duration/a.interval);
+    for(int i = 1; i <= count; ++i) {
+        const qreal t = 1-qPow(1-qreal(i)/count,3);
+        const auto mix = [t](int x0, int x1) { return x0+qRound((x1-x0)*t); };
+        a.frames << QRect(mix(from.x(),to.x()),mix(from.y(),to.y()),mix(from.width(),to.width()),mix(from.height(),to.height()));
+    }
+    // The first frame is applied now, before the window is painted at the geometry it may have jumped to
+    manager->applyAnimationFrame(a.frames.first(),sizeOnly);
+    if(count == 1) {
+        if(done)
+            done();
+        return;
+    }
+    animations.insert(manager,a);
+    if(!timer.isActive() || timer.interval() > a.interval)
+        timer.start(a.interval);
+}
+
+void WinManagerPrivate::Animator::tick()
+{
+    const qint64 now = clock.elapsed();
+    QList<std::function<void()>> callbacks;
+    for(WinManagerPrivate *manager : animations.keys()) {
+        Animation &a = animations[manager];
+        const int due = static_cast<int>(qMin<qint64>(a.frames.size()-1,(now-a.start)/a.interval));
+        if(due > a.applied) {
+            a.applied = due;
+            manager->applyAnimationFrame(a.frames[due],a.sizeOnly);
+        }
+        if(a.applied == a.frames.size()-1)
+            finish(callbacks,manager);
+    }
+    if(animations.isEmpty())
+        timer.stop();
+    // Called last, since they may start new transitions
+    for(const std::function<void()> &done : callbacks)
+        done();
+}
+
+void WinManagerPrivate::Animator::finish(QList<std::function<void()>> &callbacks, WinManagerPrivate *manager)
+{
+    auto it = animations.find(manager);
+    if(it == animations.end())
+        return;
+    if(it->applied != it->frames.size()-1)
+        manager->applyAnimationFrame(it->frames.last(),it->sizeOnly);
+    if(it->done)
+        callbacks << it->done;
+    animations.erase(it);
+}
+
+void WinManagerPrivate::Animator::finish(WinManagerPrivate *manager)
+{
+    QList<std::function<void()>> callbacks;
+    finish(callbacks,manager);
+    for(const std::function<void()> &done : callbacks)
+        done();
+}
+
+void WinManagerPrivate::Animator::remove(WinManagerPrivate *manager)
+{ animations.remove(manager); }
+
+WinManagerPrivate::ColorSampler::ColorSampler()
+{
+    tickets = 0;
+    idleTimer.setSingleShot(true);
+    connect(&idleTimer,&QTimer::timeout,this,&ColorSampler::grab);
+    worker.setMaxThreadCount(1);
+}
+
+WinManagerPrivate::ColorSampler::~ColorSampler()
+{ worker.waitForDone(); }
+
+void WinManagerPrivate::ColorSampler::request(WinManagerPrivate *manager)
+{
+    if(queue.contains(manager) || averaging.contains(manager))
+        return;
+    queue.append(manager);
+    // A zero interval fires once the pending events are handled
+    if(!idleTimer.isActive())
+        idleTimer.start(0);
+}
+
+void WinManagerPrivate::ColorSampler::cancel(WinManagerPrivate *manager)
+{
+    queue.removeOne(manager);
+    averaging.remove(manager);
+}
+
+void WinManagerPrivate::ColorSampler::grab()
+{
+    if(QGuiApplication::mouseButtons() != Qt::NoButton) {
+        idleTimer.start(retryInterval);
+        return;
+    }
+    class Average :public QRunnable
+    {
+    public:
+        QVector<QPixmap> strips;
+        ColorSampler *sampler;
+        WinManagerPrivate *manager;
+        quint64 ticket;
+        void run() override
+        {
+            // A grabbed pixmap wraps an image on raster platforms, the conversion is the copy
+            QVector<QImage> images;
+            for(int i = 0; i < strips.size(); ++i)
+                images.append(strips.at(i).toImage());
+            strips.clear();
+            const QColor color = average(images);
+            ColorSampler *s = sampler;
+            WinManagerPrivate *m = manager;
+            const quint64 t = ticket;
+            QMetaObject::invokeMethod(s,[s,m,t,color](){ s->deliver(m,t,color); },Qt::QueuedConnection);
+        }
+    };
+    const QList<WinManagerPrivate*> waiting = queue;
+    queue.clear();
+    for(WinManagerPrivate *p : waiting) {
+        if(!p->window->isVisible())
+            continue;
+        // #rect and a window moved by the window system would be in the picture
+        if(p->rectVisible || p->systemDrag || p->service->animator.isRunning(p)) {
+            queue.append(p);
+            continue;
+        }
+        const ScreenEntry &desktop = p->windowDesktop();
+        const QRect inner = p->window->frameGeometry();
+        const QRect outer = inner.adjusted(-margin,-margin,margin,margin) & desktop.geometry;
+        if(inner.contains(outer))
+            continue;
+        // Only the ring is grabbed, a maximized window leaves at most a thin strip of the screen
+        const QRect hole = inner & outer;
+        QRect strips[4];
+        if(hole.isEmpty())
+            strips[0] = outer;
+        else {
+            strips[0] = QRect(outer.left(),outer.top(),outer.width(),hole.top()-outer.top());
+            strips[1] = QRect(outer.left(),hole.bottom()+1,outer.width(),outer.bottom()-hole.bottom());
+            strips[2] = QRect(outer.left(),hole.top(),hole.left()-outer.left(),hole.height());
+            strips[3] = QRect(hole.right()+1,hole.top(),outer.right()-hole.right(),hole.height());
+        }
+        Average *job = new Average;
+        for(const QRect &strip : strips) {
+            if(strip.isEmpty())
+                continue;
+            // Coordinates of the grab are relative to the screen
+            const QPixmap pixmap = desktop.screen->grabWindow(0,strip.x()-desktop.geometry.x(),strip.y()-desktop.geometry.y(),
+                                                              strip.width(),strip.height());
+            if(!pixmap.isNull())
+                job->strips.append(pixmap);
+        }
+        if(job->strips.isEmpty()) {
+            delete job;
+            continue;
+        }
+        job->sampler = this;
+        job->manager = p;
+        job->ticket = ++tickets;
+        averaging.insert(p,job->ticket);
+        worker.start(job);
+    }
+    if(!queue.isEmpty())
+        idleTimer.start(retryInterval);
+}
+
+void WinManagerPrivate::ColorSampler::deliver(WinManagerPrivate *manager, quint64 ticket, const QColor &color)
+{
+    // The manager may be gone or may have cancelled the sample, then the ticket is not found
+    QHash<WinManagerPrivate*,quint64>::iterator it = averaging.find(manager);
+    if(it == averaging.end() || *it != ticket)
+        return;
+    averaging.erase(it);
+    if(color.isValid())
+        manager->colorSampled(color);
+}
+
+QColor WinManagerPrivate::ColorSampler::average(const QVector<QImage> &images)
+{
+    quint64 r = 0, g = 0, b = 0, count = 0;
+    for(QImage image : images) {
+        if(image.format() != QImage::Format_RGB32 && image.format() != QImage::Format_ARGB32 &&
+                image.format() != QImage::Format_ARGB32_Premultiplied)
+            image = image.convertToFormat(QImage::Format_RGB32);
+        const QRect strip = image.rect();
+        if(strip.isEmpty())
+            continue;
+        for(int y = strip.top(); y <= strip.bottom(); y += 2) {
+            const quint32 *line = reinterpret_cast<const quint32*>(image.constScanLine(y))+strip.left();
+            const int w = strip.width();
+            for(int x = 0; x < w;) {
+                // Red and blue are added in the two halves of one word, green in another. The loop has
+                // no branches and no carries between lanes for 256 pixels, so the compiler vectorizes it
+                const int end = qMin(w,x+256);
+                quint32 rb = 0, gg = 0;
+                for(; x < end; ++x) {
+                    rb += line[x] & 0x00ff00ff;
+                    gg += line[x] & 0x0000ff00;
+                }
+                r += rb >> 16;
+                b += rb & 0xffff;
+                g += gg >> 8;
+            }
+            count += w;
+        }
+    }
+    if(!count)
+        return QColor();
+    return QColor(int(r/count),int(g/count),int(b/count));
+}
+
+void WinManagerPrivate::requestColorSample()
+{
+    if(config->flags.testFlag(SampleScreenColor) && window->isVisible())
+        service->sampler.request(this);
+}
+
+void WinManagerPrivate::colorSampled(const QColor &color)
+{
+    if(window->isVisible())
+        sampleTimer.start(config->sampleInterval);
+    if(color == sampledColor)
+        return;
+    sampledColor = color;
+    // The pictures are drawn again on the next paint, see paintRect()
+    if(rectVisible)
+        for(Overlay *o : service->overlays)
+            o->rect->update();
+    emit manager->screenColorChanged(color);
+}
+
+QColor WM::screenColor()
+{
+    const WinManagerPrivate::Service *service = WinManagerPrivate::Service::instance();
+    return service->painting ? service->painting->sampledColor : QColor();
 }
 
 void WinManagerPrivate::quitApp()
@@ -781,23 +3278,33 @@ bool WinManager::disconnectQuitButton()
 
 void WinManager::showResizeFrame(const QColor &color)
 {
-    //p->frame = new QWidget(p->window);
-    p->frame->setAutoFillBackground(true);
-    p->frame->setPalette(QPalette(color));
+    p->frameColor = color;
+    if(p->frame) {
+        p->frame->setAutoFillBackground(true);
+        p->frame->setPalette(QPalette(color));
+    }
+    else
+        p->window->update();
 }
 
 void WinManager::setMaximizeButtonProperty(const char *str)
 {
-    p->maximizedButtonProperty = str;
+    p->editConfig()->maximizedButtonProperty = str;
     if(p->maximizeButton)
-        p->maximizeButton->setProperty(p->maximizedButtonProperty,p->window->isMaximized());
+        p->maximizeButton->setProperty(p->config->maximizedButtonProperty,p->window->isMaximized());
 }
 
 int WinManager::borderWidth() const
-{ return p->borderWidth; }
+{ return p->config->borderWidth; }
 
 void WinManager::setBorderWidth(int value)
-{ p->borderWidth = value; }
+{
+    p->editConfig()->borderWidth = value;
+    if(!p->frame)
+        p->window->update();
+    else
+        p->queueFrameUpdate();
+}
 
 QRect WinManager::defaultGeometry() const
 { return p->defaultGeometry; }
@@ -806,40 +3313,382 @@ void WinManager::setDefaultGeometry(const QRect &value)
 { p->defaultGeometry = value; }
 
 int WinManager::movementArea() const
-{ return p->movingArea; }
+{ return p->config->movingArea; }
 
 void WinManager::setMovemenArea(int value)
-{ p->movingArea = value; }
+{ p->editConfig()->movingArea = value; }
 
 const char *WinManager::maximizeButtonProperty() const
-{ return p->maximizedButtonProperty; }
+{ return p->config->maximizedButtonProperty; }
 
 void WinManager::setMoveCursor(const QCursor &cursor)
-{ p->movingCursor = cursor;}
+{ p->editConfig()->movingCursor = cursor;}
 
 void WinManager::overrideMaximizeSides(Sides sides)
-{ p->maximizeSides = sides; p->sideSnapSides &= ~sides; }
+{ p->editConfig()->maximizeSides = sides; p->config->sideSnapSides &= ~sides; }
 
 void WinManager::overrideSideSnapSides(Sides sides)
-{ p->sideSnapSides = sides; p->maximizeSides &= ~sides; }
+{ p->editConfig()->sideSnapSides = sides; p->config->maximizeSides &= ~sides; }
+
+SnapLayout WinManager::snapLayout() const
+{ return p->config->layout; }
+
+void WinManager::setSnapLayout(const SnapLayout &layout)
+{
+    WinManagerPrivate::Config *c = p->editConfig();
+    c->layout = layout;
+    c->zoneModes.fill(WinManagerPrivate::SnapToZone,layout.size());
+    c->zoneMaps.clear();
+    if(p->snapZone >= 0)
+        p->clearSideSnap();
+    p->pzone = -1;
+}
+
+void WinManager::overrideMaximizeZones(const QList<int> &zones)
+{
+    WinManagerPrivate::Config *c = p->editConfig();
+    for(quint8 &mode : c->zoneModes)
+        if(mode == WinManagerPrivate::MaximizeZone)
+            mode = WinManagerPrivate::DisabledZone;
+    for(int z : zones)
+        if(z >= 0 && z < c->zoneModes.size())
+            c->zoneModes[z] = WinManagerPrivate::MaximizeZone;
+}
+
+void WinManager::overrideSideSnapZones(const QList<int> &zones)
+{
+    WinManagerPrivate::Config *c = p->editConfig();
+    for(quint8 &mode : c->zoneModes)
+        if(mode == WinManagerPrivate::SnapToZone)
+            mode = WinManagerPrivate::DisabledZone;
+    for(int z : zones)
+        if(z >= 0 && z < c->zoneModes.size())
+            c->zoneModes[z] = WinManagerPrivate::SnapToZone;
+}
 
 Flags WinManager::getFlags()
-{ return p->flags; }
+{ return p->config->flags; }
 
 void WinManager::setFlags(Flags flags)
-{ p->flags |= flags; }
+{ p->setFlags(p->config->flags|flags); }
 
 void WinManager::overrideFlags(Flags flags)
-{ p->flags = flags; }
+{ p->setFlags(flags); }
 
 void WinManager::disableFlags(Flags flags)
-{ p->flags &= ~flags; }
+{ p->setFlags(p->config->flags&~flags); }
 
 bool WinManager::testFlag(Flag flag)
-{ return p->flags&flag; }
+{ return p->config->flags&flag; }
+
+void WinManager::setSnapPaintFunction(PaintFunction func, PaintCache cache)
+{ p->editConfig()->snapPainter = {func,cache,QPixmap()}; }
+
+void WinManager::setResizePaintFunction(PaintFunction func, PaintCache cache)
+{ p->editConfig()->resizePainter = {func,cache,QPixmap()}; }
+
+int WinManager::nineSliceMargin() const
+{ return p->config->sliceMargin; }
+
+void WinManager::setNineSliceMargin(int margin)
+{
+    p->editConfig()->sliceMargin = margin;
+    invalidatePaintCache();
+}
+
+int WinManager::magnetDistance() const
+{ return p->config->magnetDistance; }
+
+void WinManager::setMagnetDistance(int distance)
+{ p->editConfig()->magnetDistance = distance; }
+
+int WinManager::animationDuration() const
+{ return p->config->animationDuration; }
+
+void WinManager::setAnimationDuration(int msec)
+{ p->editConfig()->animationDuration = msec; }
+
+void WinManager::animateGeometry(const QRect &rect)
+{
+    if(p->window->isMaximized())
+        p->window->setWindowState(Qt::WindowNoState);
+    p->clearSideSnap();
+    if(p->animated())
+        p->animate(rect,false);
+    else
+        p->window->setGeometry(rect);
+}
+
+int WinManager::resizeBudget() const
+{ return p->config->resizeBudget; }
+
+void WinManager::setResizeBudget(int usec)
+{ p->editConfig()->resizeBudget = usec; }
+
+ResizeStrategy WinManager::resizeStrategy() const
+{ return p->strategy; }
+
+qint64 WinManager::resizeCost() const
+{ return p->resizeCost; }
+
+void WinManager::preloadGeometry()
+{ WinManagerPrivate::GeometryStore::instance(); }
+
+bool WinManager::listenControl(const QString &name)
+{
+#ifdef WM_CONTROL_SERVER
+    WinManagerPrivate::Service *service = WinManagerPrivate::Service::instance();
+    WinManagerPrivate::ControlServer *server = static_cast<WinManagerPrivate::ControlServer*>(service->controlServer);
+    if(!server)
+        service->controlServer = server = new WinManagerPrivate::ControlServer(service);
+    server->server.close();
+    return server->listen(name);
+#else
+    Q_UNUSED(name)
+    return false;
+#endif
+}
+
+void WinManager::closeControl()
+{
+    WinManagerPrivate::Service *service = WinManagerPrivate::Service::instance();
+    delete service->controlServer;
+    service->controlServer = nullptr;
+}
+
+void WinManager::postMove(const QPoint &pos)
+{ p->service->post(p->serial,{WinManagerPrivate::Command::Move,pos,QSize(),Side::none}); }
+
+void WinManager::postResize(const QSize &size)
+{ p->service->post(p->serial,{WinManagerPrivate::Command::Resize,QPoint(),size,Side::none}); }
+
+void WinManager::postGeometry(const QRect &rect)
+{
+    postMove(rect.topLeft());
+    postResize(rect.size());
+}
+
+void WinManager::postSnap(Side side)
+{ p->service->post(p->serial,{WinManagerPrivate::Command::Snap,QPoint(),QSize(),side}); }
+
+void WinManager::postMaximize()
+{ p->service->post(p->serial,{WinManagerPrivate::Command::Maximize,QPoint(),QSize(),Side::none}); }
+
+void WinManager::postRestore()
+{ p->service->post(p->serial,{WinManagerPrivate::Command::Restore,QPoint(),QSize(),Side::none}); }
+
+QColor WinManager::screenColor() const
+{ return p->sampledColor; }
+
+int WinManager::sampleInterval() const
+{ return p->config->sampleInterval; }
+
+void WinManager::setSampleInterval(int msec)
+{ p->editConfig()->sampleInterval = msec; }
+
+void WinManager::invalidatePaintCache()
+{
+    p->config->resizePainter.pixmap = QPixmap();
+    p->config->snapPainter.pixmap = QPixmap();
+    if(p->rectVisible)
+        for(WinManagerPrivate::Overlay *o : p->service->overlays)
+            o->rect->update();
+}
+
+void WinManager::prewarmOverlays()
+{
+    for(QScreen *screen : QGuiApplication::screens())
+        p->overlay(screen);
+}
+
+quint64 WinManager::coalescedEventCount() const
+{ return p->coalescedEvents; }
+
+void WinManager::resetCoalescedEventCount()
+{ p->coalescedEvents = 0; }
+
+Metrics WinManager::metrics() const
+{ return p->metrics; }
+
+void WinManager::resetMetrics()
+{ p->metrics = Metrics(); }
+
+void WinManager::startRecording()
+{ p->startRecording(); }
+
+QByteArray WinManager::stopRecording()
+{ return p->stopRecording(); }
+
+ReplayResult WinManager::replay(const QByteArray &trace, ReplaySpeed speed)
+{ return p->replay(trace,speed); }
+
+void WinManagerPrivate::startRecording()
+{
+    delete recorder;
+    trace.clear();
+    recorder = new QDataStream(&trace,QIODevice::WriteOnly);
+    recorder->setVersion(QDataStream::Qt_5_0);
+    *recorder << quint32(traceMagic) << quint16(traceVersion)
+              << qint32(config->flags) << qint32(config->sideSnapSides) << qint32(config->maximizeSides)
+              << qint32(config->borderWidth) << qint32(config->movingArea)
+              << window->geometry() << qint32(window->windowState())
+              << qint32(currentSnapSide) << oldWindowGeometry;
+    const QList<QScreen*> all = QGuiApplication::screens();
+    *recorder << quint8(all.size());
+    for(QScreen *screen : all)
+        *recorder << screen->geometry() << screen->availableGeometry();
+    recordClock.start();
+    lastRecorded = 0;
+}
+
+QByteArray WinManagerPrivate::stopRecording()
+{
+    delete recorder;
+    recorder = nullptr;
+    QByteArray result = trace;
+    trace.clear();
+    return result;
+}
+
+void WinManagerPrivate::recordEvent(TraceTarget target, QEvent *event)
+{
+    switch (event->type()) {
+    case QEvent::MouseMove:
+    case QEvent::MouseButtonPress:
+    case QEvent::MouseButtonDblClick:
+    case QEvent::MouseButtonRelease:
+        break;
+    default:
+        return;
+    }
+    QMouseEvent *ev = static_cast<QMouseEvent *>(event);
+    const qint64 now = recordClock.nsecsElapsed()/1000;
+    // Times are stored as the delay after the previous event
+    *recorder << quint8(target) << quint8(ev->type()) << quint8(ev->button()) << quint8(ev->buttons())
+              << qint32(ev->globalPos().x()) << qint32(ev->globalPos().y())
+              << quint32(qMin<qint64>(now-lastRecorded,UINT_MAX));
+    lastRecorded = now;
+}
+
+ReplayResult WinManagerPrivate::replay(const QByteArray &data, ReplaySpeed speed)
+{
+    ReplayResult result;
+    if(recorder)
+        return result;
+    QDataStream in(data);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic = 0;
+    quint16 version = 0;
+    in >> magic >> version;
+    if(magic != traceMagic || version != traceVersion)
+        return result;
+
+    qint32 traceFlags, snapSides, maxSides, border, area, state, snap;
+    QRect geometry, oldGeometry;
+    quint8 screenCount;
+    in >> traceFlags >> snapSides >> maxSides >> border >> area >> geometry >> state >> snap >> oldGeometry >> screenCount;
+    const QList<QScreen*> all = QGuiApplication::screens();
+    result.sameScreens = screenCount == all.size();
+    for(int i = 0; i < screenCount; ++i) {
+        QRect g, a;
+        in >> g >> a;
+        result.sameScreens = result.sameScreens && std::any_of(all.begin(),all.end(),[&](QScreen *s) {
+            return s->geometry() == g && s->availableGeometry() == a;
+        });
+    }
+    if(in.status() != QDataStream::Ok)
+        return result;
+
+    setFlags(Flags(traceFlags));
+    editConfig()->sideSnapSides = Sides(snapSides);
+    config->maximizeSides = Sides(maxSides);
+    config->movingArea = area;
+    manager->setBorderWidth(border);
+    window->setWindowState(Qt::WindowStates(state));
+    if(!(state&Qt::WindowMaximized))
+        window->setGeometry(geometry);
+    currentSnapSide = static_cast<Side>(snap);
+    snapScreen = currentSnapSide != Side::none ? windowDesktop().screen : nullptr;
+    oldWindowGeometry = oldGeometry;
+    updateFrameMask();
+
+    QElapsedTimer clock;
+    clock.start();
+    qint64 due = 0;
+    while(!in.atEnd())
+    {
+        quint8 target, type, button, buttons;
+        qint32 x, y;
+        quint32 delay;
+        in >> target >> type >> button >> buttons >> x >> y >> delay;
+        if(in.status() != QDataStream::Ok)
+            return result;
+        due += delay;
+        if(speed == RecordedSpeed) {
+            const qint64 wait = (due-clock.nsecsElapsed()/1000)/1000;
+            if(wait > 0) {
+                QEventLoop loop;
+                QTimer::singleShot(int(wait),Qt::PreciseTimer,&loop,&QEventLoop::quit);
+                loop.exec();
+            }
+        }
+        else
+            QCoreApplication::processEvents(); // Lets the due frame updates run
+
+        const QPoint global(x,y);
+        QWidget *receiver = target == TraceFrame ? frame : window;
+        if(!receiver)
+            continue;
+        QMouseEvent ev(static_cast<QEvent::Type>(type),receiver->mapFromGlobal(global),global,
+                       static_cast<Qt::MouseButton>(button),Qt::MouseButtons(buttons),Qt::NoModifier);
+        const qint64 start = clock.nsecsElapsed();
+        switch (target) {
+        case TraceWindow:
+            eventFilter(window,&ev);
+            break;
+        case TraceFrame:
+            service->eventFilter(frame,&ev);
+            break;
+        case TraceVirtualFrame:
+            eventFilter(window->windowHandle(),&ev);
+            break;
+        }
+        result.eventTimes.append((clock.nsecsElapsed()-start)/1000);
+    }
+    flushDragSteps();
+    result.valid = true;
+    result.geometry = window->geometry();
+    result.state = window->windowState();
+    result.snapSide = currentSnapSide;
+    return result;
+}
 
-void WinManager::setSnapPaintFunction(PaintFunction func)
-{ p->snapPaintFunc = func; }
+void WinManagerPrivate::recordLatency(Histogram &histogram, qint64 since)
+{
+    const quint64 latency = static_cast<quint64>(qMax<qint64>(1,metricsNow()-since));
+    const int bucket = qMin(19,63-static_cast<int>(qCountLeadingZeroBits(latency)));
+    ++histogram.counts[bucket];
+}
+
+quint64 Histogram::total() const
+{
+    quint64 n = 0;
+    for(quint64 c : counts)
+        n += c;
+    return n;
+}
 
-void WinManager::setResizePaintFunction(PaintFunction func)
-{ p->resizePaintFunc = func; }
+quint64 Histogram::percentile(double p) const
+{
+    const quint64 n = total();
+    if(!n)
+        return 0;
+    const quint64 rank = qMax<quint64>(1,static_cast<quint64>(p*n+0.5));
+    quint64 seen = 0;
+    for(int i = 0; i < 20; ++i) {
+        seen += counts[i];
+        if(seen >= rank)
+            return quint64(2) << i;
+    }
+    return quint64(2) << 19;
+}
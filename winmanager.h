@@ -9,33 +9,102 @@
 #include <QPainter>
 #include <QScreen>
 #include <QDebug>
+#include "wmgeometry.h"
 
 namespace WM
 {
-enum Side
-{
-    none = 0,
-    left = 1,
-    right = 2,
-    top = 4,
-    bottom = 8,
-    bottom_left = 16,
-    bottom_right = 32,
-    top_left = 64,
-    top_right = 128
-};
 enum Flag
 {
     DrawResizeRect = 1,       // Draw a rectangle when the window is resized
     SaveGeometry = 2,         // Save geometry after closing the application
-    HalfSnap = 4              // Is necessary to resize to half of the screen during snapping
+    HalfSnap = 4,             // Is necessary to resize to half of the screen during snapping
+    FramePacing = 8,          // Apply at most one geometry update per display frame while dragging
+    VirtualFrame = 16,        // Resize by the border of the window itself, without the masked #frame widget
+    MagneticSnap = 32,        // Stick to the edges of other managed windows when moving or resizing
+    AnimateTransitions = 64,  // Animate snapping, maximizing and restoring the window
+    SnapshotResize = 128,     // Without DrawResizeRect, stretch a picture of the window while resizing and lay it out on release
+    AdaptiveResize = 256,     // Without DrawResizeRect, choose the ResizeStrategy by the measured cost of resizing the window
+    SystemMoveResize = 512,   // Let the window system move and resize the window where it can (Qt 5.15 and newer)
+    SampleScreenColor = 1024  // Keep the average color of the screen around the window for the drawing functions
+};
+enum ResizeStrategy
+{
+    LiveResize = 0,           // The window is resized on every frame
+    ReducedRateResize = 1,    // The window is resized less often, leaving time between the steps
+    OutlineResize = 2         // #rect is resized and the window gets its geometry on release
 };
 Q_DECLARE_FLAGS(Flags,Flag)
-Q_DECLARE_FLAGS(Sides,Side)
 typedef void(*PaintFunction)(const QWidget *transparent_widget_under_picture,QPainter &painter);
+QColor screenColor();
+// Inside a drawing function, returns the average color of the screen around the window whose #rect
+// is drawn, sampled with the SampleScreenColor flag. Invalid until the first sample
+struct SnapZone
+{
+    // Rects are fractions (0..1) of the available geometry of a screen.
+    // The zone is chosen when the cursor enters one of its triggers while the window is moved,
+    // and the window then takes the target rect. A trigger of zero width or height lies on the edge of the screen
+    QRectF target;
+    QVector<QRectF> triggers;
+};
+typedef QVector<SnapZone> SnapLayout;
+SnapLayout gridLayout(int columns, int rows);
+// Equal cells, chosen on the edges of the screen: the top edge chooses a column of the first row,
+// the left edge chooses a row of the first column, and so on. gridLayout(3,1) gives thirds
+SnapLayout columnsLayout(const QVector<qreal> &widths);
+// Columns of the given fractions of the width, for example {2/3.,1/3.}
+SnapLayout loadSnapLayout(const QString &fileName);
+// Reads a JSON file: {"zones":[{"target":[x,y,w,h],"triggers":[[x,y,w,h],...]},...]}
+// Returns an empty layout on error, also when a target or trigger is not an array of 4 numbers
+enum PaintCache
+{
+    CacheBySize = 0,          // The picture is cached for sizes of #rect in 32 px steps and stretched within a step,
+                              // it is drawn again when the size crosses a step and on each press
+    SizeIndependent = 1,      // The picture is drawn once and stretched to any size of #rect
+    NineSlice = 2             // The picture is drawn once, its corners are kept and its edges and center are stretched
+};
+enum MetricKind
+{
+    MoveMetric = 0,           // Moving the window
+    ResizeMetric = 1,         // Resizing the window or #rect
+    SnapMetric = 2            // Snapping the window to the desktop side
+};
+struct Histogram
+{
+    // counts[i] is the number of latencies from 2^i to 2^(i+1) microseconds, shorter ones are in counts[0]
+    quint64 counts[20];
+    quint64 total() const;
+    quint64 percentile(double p) const;
+    // Returns the upper bound in microseconds of the bucket that holds the percentile (0..1)
+};
+struct Metrics
+{
+    // Define WM_NO_METRICS when compiling winmanager.cpp to leave out all counting and timing
+    quint64 mouseEvents;          // Mouse events handled on the window and #frame
+    quint64 coalescedEvents;      // Mouse moves merged into a pending frame update
+    quint64 geometryApplications; // Changes of the window geometry made by WinManager
+    quint64 frameMaskUpdates;     // Times #frame was fitted to a new size, snap or state of the window
+    quint64 rectCreations;        // Overlay windows created to show #rect
+    quint64 rectShows;            // Times #rect appeared
+    quint64 geometrySaves;        // Placements passed to the settings store, which writes them to QSettings in batches
+    Histogram applyLatency[3];    // From the mouse event to the applied geometry, indexed by MetricKind
+    Histogram paintLatency[3];    // From the mouse event to the painted #rect, indexed by MetricKind
+};
+enum ReplaySpeed
+{
+    RecordedSpeed = 0,        // Wait between events as long as the user did, running the event loop meanwhile
+    MaximumSpeed = 1          // Dispatch the events one after another
+};
+struct ReplayResult
+{
+    bool valid = false;           // The trace was read completely
+    bool sameScreens = false;     // The screens have the same geometries as when recording
+    QRect geometry;               // Final geometry of the window
+    Qt::WindowStates state;       // Final state of the window
+    Side snapSide = Side::none;   // Final snap to the desktop side
+    QVector<qint64> eventTimes;   // Time spent handling each event, in microseconds
+};
 }
 Q_DECLARE_OPERATORS_FOR_FLAGS (WM::Flags)
-Q_DECLARE_OPERATORS_FOR_FLAGS (WM::Sides)
 
 class WinManagerPrivate;
 class  WinManager : public QObject
@@ -44,9 +113,11 @@ class  WinManager : public QObject
      Further the following definitions will be used:
      #frame:
      A transparent frame around the edges of the window that can use to resize the window.
+     With the VirtualFrame flag it is not a widget, but the same area of the window itself,
+     and its color is painted under the child widgets.
 
      #rect:
-     This is a rectangular, transparent area that is created when the window is resized,
+     This is a rectangular, transparent area that is shown when the window is resized,
      or when the mouse is on one of the sides of desktop when moving the window (to snap to it),
      and provided that the DrawResizeRect flag is active.
      If it is created to resize, then it resizes according to the position of the cursor.
@@ -57,8 +128,21 @@ class  WinManager : public QObject
     */
     Q_OBJECT
 public:
-    explicit WinManager(QWidget *window);
+    explicit WinManager(QWidget *window, const WinManager *shareWith = nullptr);
+    // All managers of the application share one event filter, one screen index and one settings store.
+    // With shareWith the window also uses the flags, sides, #frame width, moving area, cursor and
+    // drawing functions of that manager, until either of them changes its own.
+    // With the SaveGeometry flag the geometries of all windows are kept in memory and written to
+    // QSettings by a worker thread shortly after they stop changing, and finally when the application quits.
+    // A window gets its saved geometry, maximization and snap when it is first shown, before its native
+    // window is mapped, so it appears at the final geometry with the flags and snap layout set until then.
+    // Placements are saved for each layout of the screens (their geometries and pixel densities),
+    // and restored when the application starts or the screens change to a layout seen before.
     ~WinManager() override;
+    static void preloadGeometry();
+    // Starts reading the saved geometries on a worker thread. Each manager created with the SaveGeometry
+    // flag starts it too; call it earlier, after setting the organization and application names, for a head start.
+
     WinManager(const WinManager& src) = delete;
     WinManager& operator=(const WinManager &oth) = delete;
 
@@ -105,6 +189,15 @@ public:
     void overrideSideSnapSides(WM::Sides sides);
     // Overrides the desktop sides to which the window can be bound.
 
+    WM::SnapLayout snapLayout() const;
+    void setSnapLayout(const WM::SnapLayout &layout);
+    // (Get | Set ) Zones that are used instead of the desktop sides to snap the window.
+    // All zones snap until overridden. An empty layout returns to the desktop sides.
+
+    void overrideMaximizeZones(const QList<int> &zones);
+    void overrideSideSnapZones(const QList<int> &zones);
+    // Same as the functions for sides, for the zones of the snap layout addressed by their index.
+
     WM::Flags getFlags();
 
     void setFlags(WM::Flags flags);
@@ -115,12 +208,108 @@ public:
 
     bool testFlag(WM::Flag flag);
 
-    void setSnapPaintFunction(WM::PaintFunction func);
-    void setResizePaintFunction(WM::PaintFunction func);
+    void setSnapPaintFunction(WM::PaintFunction func, WM::PaintCache cache = WM::CacheBySize);
+    void setResizePaintFunction(WM::PaintFunction func, WM::PaintCache cache = WM::CacheBySize);
+    // The default functions use WM::SizeIndependent for snap and WM::NineSlice for resize.
+
+    int nineSliceMargin() const;
+    void setNineSliceMargin(int margin);
+    // (Get | Set ) Size of the corners of the picture that WM::NineSlice does not stretch.
+
+    int magnetDistance() const;
+    void setMagnetDistance(int distance);
+    // (Get | Set ) Distance at which an edge of the window sticks to an edge of another
+    // managed window with the MagneticSnap flag.
+
+    int animationDuration() const;
+    void setAnimationDuration(int msec);
+    // (Get | Set ) Duration of the transitions with the AnimateTransitions flag.
+
+    void animateGeometry(const QRect &rect);
+    // Moves the window to the rect with a transition, or at once without the AnimateTransitions flag.
+    // Transitions of all windows run on one timer, one step per display frame, so windows
+    // moved together, for example to restore a layout, stay in step.
+
+    int resizeBudget() const;
+    void setResizeBudget(int usec);
+    // (Get | Set ) Time in microseconds that one live resize step may take with the AdaptiveResize flag.
+    // Above it the rate is reduced, above three times it #rect is used instead.
+
+    WM::ResizeStrategy resizeStrategy() const;
+    // Strategy of the current or last resize.
+
+    qint64 resizeCost() const;
+    // Average time in microseconds of a live resize step of the window, layout and paint included.
+    // 0 until measured.
+
+    QColor screenColor() const;
+    // Average color of the screen around the window with the SampleScreenColor flag, invalid until sampled.
+    // The screen is grabbed only when no mouse button is down and averaged by a worker thread,
+    // so a press uses the last sample and never waits for it.
+
+    int sampleInterval() const;
+    void setSampleInterval(int msec);
+    // (Get | Set ) Time between samples of the screen color. A sample is also taken when the window
+    // is shown and after it is moved or resized.
+
+    void postMove(const QPoint &pos);
+    void postResize(const QSize &size);
+    void postGeometry(const QRect &rect);
+    void postSnap(WM::Side side);
+    void postMaximize();
+    void postRestore();
+    // Thread-safe: can be called from any thread while the manager exists, and return without waiting.
+    // The commands of all windows are queued without locks and applied by the GUI thread together,
+    // at most once per display frame, each window painted once. Of the commands of one window only
+    // the outcome is applied: the last position and size, and the last of snap, maximize and restore,
+    // which supersedes the earlier moves. A move or resize restores a maximized or snapped window.
+    // postSnap(WM::none) is the same as postRestore().
+
+    static bool listenControl(const QString &name = QStringLiteral("WinManager"));
+    static void closeControl();
+    // (Start | Stop) The local socket endpoint that lets other processes list and arrange the managed windows.
+    // Available when winmanager.cpp is compiled with WM_CONTROL_SERVER defined and QT += network,
+    // otherwise listenControl() returns false. It also returns false when another running process listens
+    // on the name; a socket left behind by a crashed one is replaced. Each request and reply is one line of compact JSON:
+    // {"cmd":"list"} replies {"windows":[{"id" (never reused),"name","title","visible","geometry":[x,y,w,h],
+    //   "normalGeometry","maximized","minimized","snap":"none"|"left"|...|"top_right","zone"},...]}
+    // {"cmd":"apply","windows":[{"id" or "name","geometry":[x,y,w,h],"snap":side,"maximized":true,"restore":true},...]}
+    // checks the whole batch, then applies it like the posted commands, each window laid out and painted once.
+    // Replies {"applied":count} or {"error":message}, in which case nothing was changed.
+
+    void invalidatePaintCache();
+    // Makes the drawing functions draw again, for example after the colors they use have changed.
+
+    void prewarmOverlays();
+    // Creates the transparent windows that show #rect on every screen ahead of time,
+    // so the first snap or resize does not wait for a native window to be created.
+    // There is one for each screen, shared by all managers.
+
+    quint64 coalescedEventCount() const;
+    void resetCoalescedEventCount();
+    // (Get | Reset) Number of mouse moves merged into an already pending frame update.
+    // Only counts while the FramePacing flag is active.
+
+    WM::Metrics metrics() const;
+    void resetMetrics();
+    // (Get | Reset) Snapshot of the performance counters and latency histograms.
+
+    void startRecording();
+    QByteArray stopRecording();
+    // (Start | Stop) Recording the mouse events of the window and #frame into a binary trace,
+    // together with the screens, flags, sides and geometry of the window at the start.
+    // stopRecording() returns the trace.
+
+    WM::ReplayResult replay(const QByteArray &trace, WM::ReplaySpeed speed = WM::MaximumSpeed);
+    // Restores the flags, sides and geometry of the trace and passes its events to the
+    // event filters of the window and #frame. Returns the final geometry and the time of each event.
+    // The screens are not changed, ReplayResult::sameScreens tells if they match the trace.
 
 signals:
     void resizeFrameClicked(); // Emitted on click on #frame
     void sideSnapRectCreated(); // Emitted when creating #rect to snap to desktop side
+    void resizeStrategyChanged(WM::ResizeStrategy strategy); // Emitted when AdaptiveResize changes the strategy
+    void screenColorChanged(const QColor &color); // Emitted when a new sample of the screen color differs from the last
 private:
     friend class WinManagerPrivate;
     WinManagerPrivate *p;
@@ -0,0 +1,161 @@
+#ifndef WMGEOMETRY_H
+#define WMGEOMETRY_H
+
+#include <QRect>
+#include <QFlags>
+
+namespace WM
+{
+enum Side
+{
+    none = 0,
+    left = 1,
+    right = 2,
+    top = 4,
+    bottom = 8,
+    bottom_left = 16,
+    bottom_right = 32,
+    top_left = 64,
+    top_right = 128
+};
+Q_DECLARE_FLAGS(Sides,Side)
+
+namespace Geometry
+{
+/*
+ The geometry of moving, resizing and snapping, without widgets.
+ The functions take the rect of the window, its size limits, the rects of a screen and the cursor,
+ and return the rect the window should get, so the same logic can drive a QWidget, a QWindow or
+ a QML item, and can be measured without a window system.
+ Right and bottom edges are exclusive: an edge of a rect is x()+width() or y()+height().
+ The functions are constexpr; those with more than one statement only with C++14.
+*/
+struct Limits
+{
+    QSize minimum;
+    QSize maximum;
+    // Minimum and maximum size of the window, for example QWidget::minimumSize() and maximumSize()
+};
+
+Q_DECL_CONSTEXPR inline bool hasLeft(Side side)
+{ return side == left || side == top_left || side == bottom_left; }
+Q_DECL_CONSTEXPR inline bool hasRight(Side side)
+{ return side == right || side == top_right || side == bottom_right; }
+Q_DECL_CONSTEXPR inline bool hasTop(Side side)
+{ return side == top || side == top_left || side == top_right; }
+Q_DECL_CONSTEXPR inline bool hasBottom(Side side)
+{ return side == bottom || side == bottom_left || side == bottom_right; }
+// Returns whether the side moves the (left | right | top | bottom) edge of the window
+
+Q_DECL_CONSTEXPR inline Side combine(bool l, bool r, bool t, bool b)
+{
+    return t ? (l ? top_left : r ? top_right : top) :
+           b ? (l ? bottom_left : r ? bottom_right : bottom) :
+           l ? left : r ? right : none;
+}
+// Returns the side of the given edges. Left wins over right and top over bottom
+
+Q_DECL_CONSTEXPR inline Side desktopSide(const QPoint &point, const QRect &available)
+{
+    return combine(point.x() <= available.left(),point.x() >= available.right(),
+                   point.y() <= available.top(),point.y() >= available.bottom());
+}
+// Returns the side of desktop for the point, given the available geometry of the screen under it.
+// Each screen has its own sides, also on the inner edges shared with neighboring screens
+
+Q_DECL_CONSTEXPR inline Side windowSide(const QSize &size, int border, const QPoint &pos)
+{
+    return pos.x() < 0 || pos.y() < 0 || pos.x() >= size.width() || pos.y() >= size.height() ? none :
+           combine(pos.x() < border,pos.x() >= size.width()-border,pos.y() < border,pos.y() >= size.height()-border);
+}
+// Returns the side of the window of the given size for a position in window coordinates,
+// with a #frame of the given width. Side::none inside #frame and outside the window
+
+Q_DECL_CONSTEXPR inline QPoint captureOffset(const QRect &window, Side side, const QPoint &cursor)
+{
+    return QPoint(hasLeft(side) ? cursor.x()-window.x() : hasRight(side) ? cursor.x()-(window.x()+window.width()) : 0,
+                  hasTop(side) ? cursor.y()-window.y() : hasBottom(side) ? cursor.y()-(window.y()+window.height()) : 0);
+}
+// Returns the offset of the cursor from the captured edges, which is kept while resizing
+
+Q_DECL_CONSTEXPR inline QRect resized(const QRect &window, Side side, const QPoint &edge)
+{
+    return QRect(QPoint(hasLeft(side) ? edge.x() : window.x(),hasTop(side) ? edge.y() : window.y()),
+                 QPoint((hasRight(side) ? edge.x() : window.x()+window.width())-1,
+                        (hasBottom(side) ? edge.y() : window.y()+window.height())-1));
+}
+// Returns the rect with the edges of the side moved to the point, which is the cursor minus the
+// capture offset. The size is not limited, see constrained()
+
+Q_DECL_RELAXED_CONSTEXPR inline QRect constrained(const QRect &rect, Side side, const Limits &limits)
+{
+    int l = rect.x(), t = rect.y();
+    int r = rect.x()+rect.width(), b = rect.y()+rect.height();
+    // The edges that are not captured stay in place
+    if(hasLeft(side))
+        l = qBound(r-limits.maximum.width(),l,r-limits.minimum.width());
+    else
+        r = qBound(l+limits.minimum.width(),r,l+limits.maximum.width());
+    if(hasTop(side))
+        t = qBound(b-limits.maximum.height(),t,b-limits.minimum.height());
+    else
+        b = qBound(t+limits.minimum.height(),b,t+limits.maximum.height());
+    return QRect(l,t,r-l,b-t);
+}
+// Returns the rect with its size within the limits, moving only the captured edges
+
+Q_DECL_RELAXED_CONSTEXPR inline QRect fitted(const QRect &rect, const QRect &available)
+{
+    QPoint pos = rect.topLeft();
+    if(pos.x() < available.x())
+        pos.setX(available.x());
+    else if(pos.x()+rect.width() > available.x()+available.width())
+        pos.setX(available.x()+available.width()-rect.width());
+    if(pos.y() < available.y())
+        pos.setY(available.y());
+    else if(pos.y()+rect.height() > available.y()+available.height())
+        pos.setY(available.y()+available.height()-rect.height());
+    return QRect(pos,rect.size());
+}
+// Returns the rect moved into the available geometry of a screen, its left and top edges win
+
+Q_DECL_CONSTEXPR inline QRect restored(const QPoint &cursor, const QSize &size, int grab)
+{ return QRect(QPoint(cursor.x()-size.width()/2,cursor.y()-grab),size); }
+// Returns the rect of a maximized or snapped window restored to the size when dragged,
+// centered under the cursor which holds it grab pixels below the top edge
+
+Q_DECL_RELAXED_CONSTEXPR inline QRect snapRect(const QRect &available, Side side, const QSize &size)
+{
+    const QRect &ds = available;
+    switch (side) {
+    case top:
+        return QRect(ds.x(),ds.y(),ds.width(),size.height());
+    case bottom:
+        return QRect(ds.x(),ds.y()+ds.height()-size.height(),ds.width(),size.height());
+    case left:
+        return QRect(ds.x(),ds.y(),size.width(),ds.height());
+    case right:
+        return QRect(ds.x()+ds.width()-size.width(),ds.y(),size.width(),ds.height());
+    case top_left:
+        return QRect(ds.topLeft(),size);
+    case top_right:
+        return QRect(QPoint(ds.x()+ds.width()-size.width(),ds.y()),size);
+    case bottom_left:
+        return QRect(QPoint(ds.x(),ds.y()+ds.height()-size.height()),size);
+    case bottom_right:
+        return QRect(QPoint(ds.x()+ds.width()-size.width(),ds.y()+ds.height()-size.height()),size);
+    default:
+        return ds;
+    }
+}
+// Returns the rect of a window of the given size anchored to the side of the available geometry.
+// Sides stretch the window along the edge, corners keep its size. Side::none fills the geometry
+
+Q_DECL_RELAXED_CONSTEXPR inline QRect halfSnapRect(const QRect &available, Side side)
+{ return snapRect(available,side,QSize(available.width()/2,available.height()/2)); }
+// Returns the half or quarter of the available geometry for the side, as with the HalfSnap flag
+}
+}
+Q_DECLARE_OPERATORS_FOR_FLAGS (WM::Sides)
+
+#endif